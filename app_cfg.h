@@ -38,6 +38,54 @@
  */
 #define APP_CFG_UC APP_CFG_UC_ESP8266
 
+/**
+ * Measure the time needed to handle an event per state. When enabled the results are printed each
+ * APP_CFG_EVENT_TIMING_REPORT_TIME msec on the serial port. Keep disabled for normal use.
+ */
+#define APP_CFG_EVENT_TIMING 0
+#define APP_CFG_EVENT_TIMING_REPORT_TIME 10000
+
+/**
+ * Measure the latency from a speed change of the pulse switch until the drive command is transmitted and until
+ * the loc info of the control unit is shown on the screen. Results (p50 / p99) are printed on the serial port.
+ * Keep disabled for normal use.
+ */
+#define APP_CFG_LATENCY_MEASUREMENT 0
+
+/**
+ * Time in msec without a received status or loc info broadcast of the active loc before the data is requested from
+ * the control unit again. Independent of this time data is requested when nothing was transmitted for 30 seconds,
+ * the Z21 removes clients not transmitting for a minute. Set to 0 to request the data every keep alive period
+ * (3 seconds).
+ */
+#define APP_CFG_REQUEST_REFRESH_TIME 15000
+
+/**
+ * Transmission of the loc database. Each APP_CFG_LOC_DB_TX_INTERVAL msec APP_CFG_LOC_DB_TX_ENTRIES_PER_INTERVAL
+ * locs are transmitted, each loc in its own packet because older WMC versions only read the first loc of a packet.
+ * The complete database is transmitted APP_CFG_LOC_DB_TX_REPEAT times so a receiver missing a packet gets the locs
+ * during the next pass.
+ */
+#define APP_CFG_LOC_DB_TX_INTERVAL 50
+#define APP_CFG_LOC_DB_TX_ENTRIES_PER_INTERVAL 4
+#define APP_CFG_LOC_DB_TX_REPEAT 3
+
+/**
+ * Store frequently changing settings (e.g. last used turnout address) in a journal in flash instead of in the EEPROM.
+ * The journal uses the last two sectors (8 kB) of the file system area of the flash layout, the WMC does not use a
+ * file system. Select a flash layout with a file system of at least 8 kB, otherwise the settings are not stored. Set
+ * to 0 when the file system area is used otherwise.
+ */
+#define APP_CFG_JOURNAL 1
+
+/**
+ * Request the loc info of the locs around the selected loc after start up so the loc cache is filled before they are
+ * selected. One loc is requested each APP_CFG_LOC_CACHE_WARM_UP_INTERVAL msec and only while the operator does not
+ * control a loc, so the load of the Z21 and the latency of commands are not affected.
+ */
+#define APP_CFG_LOC_CACHE_WARM_UP 1
+#define APP_CFG_LOC_CACHE_WARM_UP_INTERVAL 200
+
 /**
  * Pin definitions for the TFT display.
  */
@@ -7,7 +7,30 @@
 
 typedef tinyfsm::FsmList<wmcApp, wmcCv> fsm_list;
 
-/* wrapper to fsm_list::dispatch() */
-template <typename E> void send_event(E const& event) { fsm_list::template dispatch<E>(event); }
+/* wrapper to fsm_list::dispatch(), received data is processed before an event is dispatched. */
+template <typename E> void send_event(E const& event)
+{
+#if APP_CFG_EVENT_TIMING == 1
+    wmcApp* StatePtr;
+    uint32_t Start;
+    uint32_t NestedStart;
+#endif
+
+    wmcApp::EventDispatchBegin();
+
+#if APP_CFG_EVENT_TIMING == 1
+    StatePtr    = wmcApp::current_state_ptr;
+    NestedStart = wmcApp::EventTimingNested();
+    Start       = micros();
+#endif
+
+    fsm_list::template dispatch<E>(event);
+
+#if APP_CFG_EVENT_TIMING == 1
+    wmcApp::EventTimingUpdate(StatePtr, micros() - Start, NestedStart);
+#endif
+
+    wmcApp::EventDispatchEnd();
+}
 
 #endif
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""
+Minimal Z21 command station stand-in for testing the WMC on a local network.
+
+Answers the messages transmitted by wmcApp::WmcCheckForDataTx (status, track power, stop, loc info, loc drive,
+loc function, turnout and CV programming) and logs the arrival time of each received frame. Start the script on
+a PC, enter the IP address of the PC as Z21 address in the WMC and enable APP_CFG_LATENCY_MEASUREMENT in the
+firmware to get the latency figures of the handheld.
+
+With --relay LAN_X frames not handled by the simulator (e.g. the loc database transmitted from the menu) are
+forwarded to all other clients, so the transmission and the reception of the loc database can be measured with two
+handhelds.
+
+Usage: z21_sim.py [--port 21105] [--log arrivals.csv] [--reply-delay msec] [--relay]
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+LAN_X_HEADER = 0x0040
+LAN_SET_BROADCASTFLAGS = 0x0050
+
+CENTRAL_EMERGENCY_STOP = 0x01
+CENTRAL_TRACK_VOLTAGE_OFF = 0x02
+CENTRAL_PROGRAMMING_MODE = 0x20
+
+STEPS_TO_DB2 = {0x10: 0, 0x12: 2, 0x13: 4}
+
+
+def xor(data):
+    """Checksum of the X-bus part of a frame."""
+    result = 0
+    for value in data:
+        result ^= value
+    return result
+
+
+def lan_x_frame(payload):
+    """Create a LAN_X frame, checksum is added."""
+    payload = bytes(payload) + bytes([xor(payload)])
+    return struct.pack("<HH", len(payload) + 4, LAN_X_HEADER) + payload
+
+
+class Loc:
+    """State of one locomotive."""
+
+    def __init__(self, address):
+        self.address = address
+        self.steps = 0x12
+        self.drive = 0x80
+        self.functions = 0
+
+    def info(self):
+        """Compose LAN_X_LOCO_INFO."""
+        msb = ((self.address >> 8) & 0x3F) | (0xC0 if self.address >= 128 else 0)
+        db4 = ((self.functions & 0x01) << 4) | ((self.functions >> 1) & 0x0F)
+        return lan_x_frame(
+            [
+                0xEF,
+                msb,
+                self.address & 0xFF,
+                STEPS_TO_DB2.get(self.steps, 2),
+                self.drive,
+                db4,
+                (self.functions >> 5) & 0xFF,
+                (self.functions >> 13) & 0xFF,
+                (self.functions >> 21) & 0xFF,
+            ]
+        )
+
+
+class Z21Simulator:
+    """Receive frames, update the state and transmit the responses."""
+
+    def __init__(self, port, log_file, reply_delay, relay):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("", port))
+        self.log_file = log_file
+        self.reply_delay = reply_delay / 1000.0
+        self.relay = relay
+        self.central_state = CENTRAL_TRACK_VOLTAGE_OFF
+        self.locs = {}
+        self.clients = set()
+        self.counters = {}
+        self.start = time.perf_counter()
+
+    def loc(self, address):
+        if address not in self.locs:
+            self.locs[address] = Loc(address)
+        return self.locs[address]
+
+    def send(self, client, frame):
+        if self.reply_delay > 0:
+            time.sleep(self.reply_delay)
+        self.sock.sendto(frame, client)
+
+    def broadcast(self, frame):
+        for client in self.clients:
+            self.send(client, frame)
+
+    def forward(self, source, frame):
+        for client in self.clients:
+            if client != source:
+                self.send(client, frame)
+
+    def power_broadcast(self):
+        if self.central_state & CENTRAL_EMERGENCY_STOP:
+            self.broadcast(lan_x_frame([0x81, 0x00]))
+        elif self.central_state & CENTRAL_TRACK_VOLTAGE_OFF:
+            self.broadcast(lan_x_frame([0x61, 0x00]))
+        elif self.central_state & CENTRAL_PROGRAMMING_MODE:
+            self.broadcast(lan_x_frame([0x61, 0x02]))
+        else:
+            self.broadcast(lan_x_frame([0x61, 0x01]))
+
+    def log(self, stamp, client, name, frame):
+        self.counters[name] = self.counters.get(name, 0) + 1
+        if self.log_file is not None:
+            self.log_file.write("%.6f,%s,%s,%s\n" % (stamp, client[0], name, frame.hex()))
+
+    def handle_x(self, client, data):
+        """Handle the X-bus part of a LAN_X frame, returns a name for logging."""
+        if data[0] == 0x21 and data[1] == 0x24:
+            self.send(client, lan_x_frame([0x62, 0x22, self.central_state]))
+            return "LAN_X_GET_STATUS"
+        if data[0] == 0x21 and data[1] == 0x81:
+            self.central_state = 0
+            self.power_broadcast()
+            return "LAN_X_SET_TRACK_POWER_ON"
+        if data[0] == 0x21 and data[1] == 0x80:
+            self.central_state = CENTRAL_TRACK_VOLTAGE_OFF
+            self.power_broadcast()
+            return "LAN_X_SET_TRACK_POWER_OFF"
+        if data[0] == 0x80:
+            self.central_state = CENTRAL_EMERGENCY_STOP
+            self.power_broadcast()
+            return "LAN_X_SET_STOP"
+        if data[0] == 0xE3 and data[1] == 0xF0:
+            loc = self.loc(((data[2] & 0x3F) << 8) | data[3])
+            self.send(client, loc.info())
+            return "LAN_X_GET_LOCO_INFO"
+        if data[0] == 0xE4 and (data[1] & 0xF0) == 0x10:
+            loc = self.loc(((data[2] & 0x3F) << 8) | data[3])
+            loc.steps = data[1]
+            loc.drive = data[4]
+            self.broadcast(loc.info())
+            return "LAN_X_SET_LOCO_DRIVE"
+        if data[0] == 0xE4 and data[1] == 0xF8:
+            loc = self.loc(((data[2] & 0x3F) << 8) | data[3])
+            mask = 1 << (data[4] & 0x3F)
+            switch = data[4] >> 6
+            if switch == 0:
+                loc.functions &= ~mask
+            elif switch == 1:
+                loc.functions |= mask
+            else:
+                loc.functions ^= mask
+            self.broadcast(loc.info())
+            return "LAN_X_SET_LOCO_FUNCTION"
+        if data[0] == 0x53:
+            self.broadcast(lan_x_frame([0x43, data[1], data[2], 1 + (data[3] & 0x01)]))
+            return "LAN_X_SET_TURNOUT"
+        if data[0] == 0x23 and data[1] == 0x11:
+            self.broadcast(lan_x_frame([0x61, 0x02]))
+            self.send(client, lan_x_frame([0x64, 0x14, data[2], data[3], 3]))
+            return "LAN_X_CV_READ"
+        if data[0] == 0x24 and data[1] == 0x12:
+            self.broadcast(lan_x_frame([0x61, 0x02]))
+            self.send(client, lan_x_frame([0x64, 0x14, data[2], data[3], data[4]]))
+            return "LAN_X_CV_WRITE"
+        if data[0] == 0xE6 and data[1] == 0x30:
+            return "LAN_X_CV_POM_WRITE_BYTE"
+        return "LAN_X_UNKNOWN"
+
+    def handle_datagram(self, stamp, client, datagram):
+        """A datagram may contain several frames, handle each of them."""
+        self.clients.add(client)
+        self.counters["DATAGRAMS"] = self.counters.get("DATAGRAMS", 0) + 1
+        offset = 0
+        while offset + 4 <= len(datagram):
+            length, header = struct.unpack_from("<HH", datagram, offset)
+            if (length < 4) or (offset + length > len(datagram)):
+                self.log(stamp, client, "INVALID_LENGTH", datagram[offset:])
+                break
+            frame = datagram[offset : offset + length]
+            if header == LAN_X_HEADER and length > 5:
+                name = self.handle_x(client, frame[4:])
+                if self.relay and name == "LAN_X_UNKNOWN":
+                    self.forward(client, frame)
+                    name = "LAN_X_RELAYED"
+            elif header == LAN_SET_BROADCASTFLAGS:
+                name = "LAN_SET_BROADCASTFLAGS"
+            else:
+                name = "UNKNOWN_%04X" % header
+            self.log(stamp, client, name, frame)
+            offset += length
+
+    def run(self):
+        print("Z21 simulator listening on port %d" % self.sock.getsockname()[1])
+        try:
+            while True:
+                datagram, client = self.sock.recvfrom(1500)
+                self.handle_datagram(time.perf_counter() - self.start, client, datagram)
+        except KeyboardInterrupt:
+            pass
+
+        for name in sorted(self.counters):
+            print("%-28s %d" % (name, self.counters[name]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Z21 command station simulator")
+    parser.add_argument("--port", type=int, default=21105)
+    parser.add_argument("--log", help="CSV file for the arrival time of each frame")
+    parser.add_argument("--reply-delay", type=float, default=0.0, help="delay in msec before each response")
+    parser.add_argument("--relay", action="store_true", help="forward unhandled LAN_X frames to the other clients")
+    args = parser.parse_args()
+
+    log_file = open(args.log, "w", buffering=1) if args.log else None
+    Z21Simulator(args.port, log_file, args.reply_delay, args.relay).run()
+    if log_file is not None:
+        log_file.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -65,7 +65,7 @@ uint8_t wmcApp::m_IpAddresZ21[4];
 uint8_t wmcApp::m_IpAddresWmc[4];
 uint8_t wmcApp::m_IpGateway[4];
 uint8_t wmcApp::m_IpSubnet[4];
-byte wmcApp::m_WmcPacketBuffer[40];
+uint8_t wmcApp::m_RxFrame[RX_FRAME_BUFFER_SIZE];
 wmcApp::powerState wmcApp::m_TrackPower       = powerState::off;
 uint16_t wmcApp::m_ConnectCnt                 = 0;
 uint16_t wmcApp::m_UdpLocalPort               = 21105;
@@ -75,14 +75,48 @@ Z21Slave::turnout wmcApp::m_TurnOutDirection  = Z21Slave::directionForwardOff;
 uint32_t wmcApp::m_TurnoutOffDelay            = 0;
 uint8_t wmcApp::m_locFunctionAdd              = 0;
 uint8_t wmcApp::m_locFunctionChange           = 0;
-uint16_t wmcApp::m_LocInfoRequestCounter      = 0;
+bool wmcApp::m_LocInfoRequestFailed           = false;
 uint16_t wmcApp::m_locAddressDelete           = 0;
 uint16_t wmcApp::m_LocAddresActualDelete      = 0;
 uint16_t wmcApp::m_locAddressChange           = 0;
 uint16_t wmcApp::m_locAddressChangeActive     = 0;
 uint16_t wmcApp::m_locDbDataTransmitCnt       = 0;
-uint32_t wmcApp::m_locDbDataTransmitCntRepeat = 0;
-bool wmcApp::m_WmcLocSpeedRequestPending      = false;
+uint8_t wmcApp::m_locDbDataTransmitPass       = 0;
+uint32_t wmcApp::m_locDbDataTransmitTime      = 0;
+bool wmcApp::m_LocLibRxActive                 = false;
+uint8_t wmcApp::m_LocLibRxTotal               = 0;
+uint8_t wmcApp::m_LocLibRxCount               = 0;
+uint32_t wmcApp::m_LocLibRxTime               = 0;
+bool wmcApp::m_LocIndexValid                  = false;
+uint16_t wmcApp::m_JournalOffset              = 0;
+uint8_t wmcApp::m_JournalValid                = 0;
+bool wmcApp::m_JournalFlash                   = false;
+uint8_t wmcApp::m_JournalSector               = 0;
+uint16_t wmcApp::m_JournalSequence            = 0;
+uint32_t wmcApp::m_JournalWrites              = 0;
+uint32_t wmcApp::m_JournalCompactions         = 0;
+uint32_t wmcApp::m_LocCacheHits               = 0;
+uint32_t wmcApp::m_LocCacheMisses             = 0;
+uint32_t wmcApp::m_LocCacheAgeTotal           = 0;
+uint32_t wmcApp::m_LocCacheAgeMax             = 0;
+bool wmcApp::m_LocCacheProvisional            = false;
+int8_t wmcApp::m_LocPrefetchDirection         = 1;
+uint8_t wmcApp::m_LocPrefetchCount            = LOC_PREFETCH_DEPTH + 1;
+uint32_t wmcApp::m_LocPrefetchTime            = 0;
+uint32_t wmcApp::m_LocPrefetchStartTime       = 0;
+uint32_t wmcApp::m_LocPrefetchRequests        = 0;
+bool wmcApp::m_LocPrefetchResubscribe         = false;
+bool wmcApp::m_LocWarmUpDone                  = false;
+bool wmcApp::m_LocWarmUpActive                = false;
+uint16_t wmcApp::m_LocWarmUpCount             = 0;
+uint16_t wmcApp::m_LocWarmUpTotal             = 0;
+uint32_t wmcApp::m_LocWarmUpTime              = 0;
+bool wmcApp::m_WmcLocSpeedTxPending           = false;
+bool wmcApp::m_WmcLocSpeedReplyPending        = false;
+uint16_t wmcApp::m_WmcLocSpeedTarget          = 0;
+uint32_t wmcApp::m_WmcLocSpeedTxTime          = 0;
+uint16_t wmcApp::m_WmcLocSpeedTxAddress        = 0;
+uint16_t wmcApp::m_WmcLocSpeedTxSpeed          = 0;
 bool wmcApp::m_CvPomProgramming               = false;
 bool wmcApp::m_CvPomProgrammingFromPowerOn    = false;
 bool wmcApp::m_EmergencyStopEnabled           = false;
@@ -92,15 +126,64 @@ bool wmcApp::m_TurnoutAutoOff                 = false;
 uint8_t wmcApp::m_ButtonIndexPrevious         = 0;
 uint8_t wmcApp::m_AdcIndex                    = 0;
 uint16_t wmcApp::m_AdcButtonValuePrevious     = 1024;
+uint8_t wmcApp::m_RxPacketsTick               = 0;
+uint8_t wmcApp::m_RxPacketsTickMax            = 0;
+uint32_t wmcApp::m_RxBacklogCnt               = 0;
+uint32_t wmcApp::m_RxFrameErrorCnt            = 0;
+uint32_t wmcApp::m_RxFrameSkipCnt             = 0;
+int wmcApp::m_WmcPacketRemaining              = 0;
+uint32_t wmcApp::m_RxBytesCopied              = 0;
+uint32_t wmcApp::m_RxLocInfoFiltered          = 0;
+uint8_t wmcApp::m_EventDispatchDepth          = 0;
+uint16_t wmcApp::m_TxBufferLength             = 0;
+uint8_t wmcApp::m_TxBufferFrames              = 0;
+uint8_t wmcApp::m_TxFramesPacketMax           = 0;
+uint32_t wmcApp::m_TxFrames                   = 0;
+uint32_t wmcApp::m_TxPackets                  = 0;
+uint32_t wmcApp::m_TxTime                     = 0;
+uint8_t wmcApp::m_TxBuffer[TX_PACKET_BUFFER_SIZE];
+wmcApp::request wmcApp::m_Requests[requestTypes];
+const uint16_t wmcApp::m_RequestTimeout[requestTypes]
+    = { REQUEST_TIMEOUT_STATUS, REQUEST_TIMEOUT_LOC_INFO, REQUEST_TIMEOUT_PREFETCH };
+uint8_t wmcApp::m_LocSubscriptions = 0;
 
 uint8_t wmcApp::m_locFunctionAssignment[5];
 uint16_t wmcApp::m_AdcButtonValue[ADC_VALUES_ARRAY_SIZE];
+wmcApp::locLibRxEntry wmcApp::m_LocLibRx[LOC_LIB_RX_ENTRIES_MAX];
+uint8_t wmcApp::m_LocLibRxBitmap[(LOC_LIB_RX_ENTRIES_MAX + 7) / 8];
+wmcApp::locIndexEntry wmcApp::m_LocIndex[LOC_INDEX_SIZE];
+uint16_t wmcApp::m_JournalValues[journalKeys];
+wmcApp::locCacheEntry wmcApp::m_LocCache[LOC_CACHE_SIZE];
+
+#if APP_CFG_JOURNAL == 1
+/* File system area of the flash layout, defined by the linker script. The journal uses its last sectors. */
+extern "C" uint32_t _FS_start;
+extern "C" uint32_t _FS_end;
+#endif
 
 pushButtonsEvent wmcApp::m_wmcPushButtonEvent;
 Z21Slave::locInfo wmcApp::m_WmcLocInfoControl;
+Z21Slave::locDirection wmcApp::m_WmcLocSpeedTxDirection = Z21Slave::locDirectionForward;
 Z21Slave::locInfo* wmcApp::m_WmcLocInfoReceived = NULL;
 Z21Slave::locLibData* wmcApp::m_WmcLocLibInfo   = NULL;
 
+#if APP_CFG_EVENT_TIMING == 1
+wmcApp::eventTiming wmcApp::m_EventTiming[EVENT_TIMING_STATES];
+uint32_t wmcApp::m_EventTimingReportTime = 0;
+uint32_t wmcApp::m_EventTimingNested     = 0;
+uint32_t wmcApp::m_RxFrames              = 0;
+uint32_t wmcApp::m_RxFrameCycles         = 0;
+#endif
+
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+uint32_t wmcApp::m_LatencyStart                    = 0;
+bool wmcApp::m_LatencyWirePending                  = false;
+bool wmcApp::m_LatencyWireDriveQueued              = false;
+bool wmcApp::m_LatencyScreenPending                = false;
+wmcApp::latencyMeasurement wmcApp::m_LatencyWire   = { "PULSE SWITCH TO TX", { 0 }, 0 };
+wmcApp::latencyMeasurement wmcApp::m_LatencyScreen = { "PULSE SWITCH TO SCREEN", { 0 }, 0 };
+#endif
+
 /***********************************************************************************************************************
   F U N C T I O N S
  **********************************************************************************************************************/
@@ -160,6 +243,13 @@ class stateSetUpWifi : public wmcApp
 
         m_locLib.Init(m_LocStorage);
         m_WmcCommandLine.Init(m_locLib, m_LocStorage);
+
+        JournalInit();
+        m_TurnOutAddress = JournalGet(journalTurnoutAddress, ADDRESS_TURNOUT_MIN);
+        if ((m_TurnOutAddress < ADDRESS_TURNOUT_MIN) || (m_TurnOutAddress > ADDRESS_TURNOUT_MAX))
+        {
+            m_TurnOutAddress = ADDRESS_TURNOUT_MIN;
+        }
         m_wmcTft.UpdateStatus("CONNECTING TO WIFI", true, WmcTft::color_yellow);
         m_wmcTft.UpdateRunningWheel(m_ConnectCnt);
 
@@ -282,8 +372,7 @@ class stateInitUdpConnect : public wmcApp
 
         if (m_ConnectCnt < CONNECT_CNT_MAX_FAIL_CONNECT_UDP)
         {
-            m_z21Slave.LanGetStatus();
-            WmcCheckForDataTx();
+            RequestTransmit(requestStatus, 0);
             m_wmcTft.UpdateRunningWheel(m_ConnectCnt);
         }
         else
@@ -295,9 +384,9 @@ class stateInitUdpConnect : public wmcApp
     /**
      * Handle the response on the status message.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff:
         case Z21Slave::programmingMode:
@@ -323,9 +412,9 @@ class stateInitUdpConnectFail : public wmcApp
      * Handle the response on the status message of the 3 seconds update event,
      * control device might be enabled somewhat later.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff:
         case Z21Slave::programmingMode:
@@ -370,13 +459,12 @@ class stateAdcButtons : public wmcApp
 
                 if (m_AdcIndex >= 6)
                 {
-                    // Store all "learned" data.
+                    // Store all "learned" data, commit once when all data is written.
                     for (Index = 0; Index < ADC_VALUES_ARRAY_SIZE; Index++)
                     {
                         EEPROM.write(
                             EepCfg::ButtonAdcValuesAddress + (Index * 2), (m_AdcButtonValue[Index] >> 8) & 0xFF);
                         EEPROM.write(EepCfg::ButtonAdcValuesAddress + (Index * 2) + 1, m_AdcButtonValue[Index] & 0xFF);
-                        EEPROM.commit();
                     }
 
                     buttonAdcValid = 1;
@@ -433,18 +521,14 @@ class stateInitStatusGet : public wmcApp
     /**
      * Get the status.
      */
-    void entry() override
-    {
-        m_z21Slave.LanGetStatus();
-        WmcCheckForDataTx();
-    };
+    void entry() override { RequestTransmit(requestStatus, 0); };
 
     /**
      * Check response of status request.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff:
             m_TrackPower = powerState::off;
@@ -467,9 +551,15 @@ class stateInitStatusGet : public wmcApp
     };
 
     /**
-     * No response, retry.
+     * No response, retry. Keep on trying when the maximum number of retries is reached.
      */
-    void react(updateEvent500msec const&) override { m_z21Slave.LanGetStatus(); };
+    void react(updateEvent500msec const&) override
+    {
+        if (RequestRetry(requestStatus) == false)
+        {
+            RequestTransmit(requestStatus, 0);
+        }
+    };
 
     /**
      * Override update during init.
@@ -488,43 +578,27 @@ class stateInitLocInfoGet : public wmcApp
     void entry() override
     {
         /* Get loc data. */
-        m_LocInfoRequestCounter = 0;
+        m_LocInfoRequestFailed = false;
         m_locLib.UpdateLocData(m_locLib.GetActualLocAddress());
-        m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-        WmcCheckForDataTx();
+        RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress());
     };
 
     /**
      * Handle response of loc request and if loc data received setup screen.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21LocInfoEvent const&) override
     {
-        switch (WmcCheckForDataRx())
+        m_wmcTft.Clear();
+        if (updateLocInfo(true) == true)
         {
-        case Z21Slave::locinfo:
-            m_wmcTft.Clear();
-            if (updateLocInfoOnScreen(true) == true)
-            {
-                m_locLib.SpeedUpdate(m_WmcLocInfoReceived->Speed);
-
-                if (m_WmcLocInfoReceived->Direction == Z21Slave::locDirectionForward)
-                {
-                    m_locLib.DirectionSet(directionForward);
-                }
-                else
-                {
-                    m_locLib.DirectionSet(directionBackWard);
-                }
+            LocWarmUpStart();
 
-                switch (m_TrackPower)
-                {
-                case powerState::off: transit<statePowerOff>(); break;
-                case powerState::on: transit<statePowerOn>(); break;
-                case powerState::emergency: transit<stateEmergencyStop>(); break;
-                }
+            switch (m_TrackPower)
+            {
+            case powerState::off: transit<statePowerOff>(); break;
+            case powerState::on: transit<statePowerOn>(); break;
+            case powerState::emergency: transit<stateEmergencyStop>(); break;
             }
-            break;
-        default: break;
         }
     };
 
@@ -533,14 +607,11 @@ class stateInitLocInfoGet : public wmcApp
      */
     void react(updateEvent500msec const&) override
     {
-        m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-        WmcCheckForDataTx();
-
-        m_LocInfoRequestCounter++;
-        if (m_LocInfoRequestCounter > 10)
+        if (RequestRetry(requestLocInfo) == false)
         {
             // If a loc is requested not known by the command station there might be no response.
-            // So after 5 seconds jump to power off so a new loc can be selected..
+            // So after all retries jump to power off so a new loc can be selected..
+            m_LocInfoRequestFailed = true;
             transit<statePowerOff>();
         }
     }
@@ -556,8 +627,7 @@ class stateInitLocInfoGet : public wmcApp
  */
 class statePowerOff : public wmcApp
 {
-    uint8_t Index                    = 0;
-    uint8_t locFunctionAssignment[5] = { 0, 1, 2, 3, 4 };
+    uint8_t Index = 0;
 
     /**
      * Update status row.
@@ -570,82 +640,94 @@ class statePowerOff : public wmcApp
 
         // IF no response was received during loc info state show loc address in magenta color
         // indicating something is wrong....
-        if (m_LocInfoRequestCounter > 10)
+        if (m_LocInfoRequestFailed == true)
         {
             m_wmcTft.ShowlocAddress(m_locLib.GetActualLocAddress(), WmcTft::color_magenta);
         }
     }
 
     /**
-     * Handle received data.
+     * Handle power status.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOn: transit<statePowerOn>(); break;
         case Z21Slave::programmingMode: transit<statePowerProgrammingMode>(); break;
-        case Z21Slave::locinfo:
-            updateLocInfoOnScreen(false);
-            m_locLib.SpeedUpdate(m_WmcLocInfoReceived->Speed);
+        default: break;
+        }
+    }
 
-            if (m_WmcLocInfoReceived->Direction == Z21Slave::locDirectionForward)
-            {
-                m_locLib.DirectionSet(directionForward);
-            }
-            else
-            {
-                m_locLib.DirectionSet(directionBackWard);
-            }
-            break;
-        case Z21Slave::locLibraryData:
-            m_WmcLocLibInfo = m_z21Slave.LanXLocLibData();
+    /**
+     * Handle loc data.
+     */
+    void react(z21LocInfoEvent const&) override
+    {
+        if ((updateLocInfo(false) == true) && (LocCacheProvisionalEnd() == true))
+        {
+            m_wmcTft.UpdateStatus("POWER OFF", false, WmcTft::color_red);
+        }
+    }
 
-            /* First database data show status... */
-            if (m_WmcLocLibInfo->Actual == 0)
-            {
-                m_wmcTft.UpdateStatus("RECEIVING", false, WmcTft::color_white);
-            }
+    /**
+     * Handle received loc library data.
+     */
+    void react(z21LocLibDataEvent const& e) override
+    {
+        m_WmcLocLibInfo = e.DataPtr;
 
-            /* If loc not present store it. */
-            if (m_locLib.CheckLoc(m_WmcLocLibInfo->Address) == 255)
-            {
-                m_locLib.StoreLoc(m_WmcLocLibInfo->Address, locFunctionAssignment, m_WmcLocLibInfo->NameStr,
-                    LocLib::storeAddNoAutoSelect);
-                m_wmcTft.UpdateSelectedAndNumberOfLocs(
-                    m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
-            }
+        /* First database data show status... */
+        if (m_LocLibRxActive == false)
+        {
+            m_wmcTft.UpdateStatus("RECEIVING", false, WmcTft::color_white);
+        }
 
-            /* If all locs received sort... */
-            if ((m_WmcLocLibInfo->Actual + 1) == m_WmcLocLibInfo->Total)
-            {
-                m_wmcTft.UpdateStatus("SORTING  ", false, WmcTft::color_white);
-                m_locLib.LocBubbleSort();
-                m_wmcTft.UpdateStatus("POWER OFF", false, WmcTft::color_red);
-            }
-            break;
-        default: break;
+        /* Collect the locs, store them when all locs are received. */
+        if (LocLibRxAdd(m_WmcLocLibInfo) == true)
+        {
+            LocLibRxCommit();
         }
     }
 
+    /**
+     * Request loc info of the locs next to the selected loc and fill the loc cache after start up.
+     */
+    void react(updateEvent5msec const&) override
+    {
+        LocPrefetch();
+
+        if (LocWarmUp() == true)
+        {
+            m_wmcTft.UpdateStatus("POWER OFF", false, WmcTft::color_red);
+        }
+    };
+
+    /**
+     * Retry loc info request when no response was received. Store the received part of the loc database when the
+     * transmission stopped.
+     */
     void react(updateEvent500msec const&)
     {
         if (m_locSelection == false)
         {
-            m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-            WmcCheckForDataTx();
+            RequestRetry(requestLocInfo);
+        }
+
+        if ((m_LocLibRxActive == true) && ((millis() - m_LocLibRxTime) >= LOC_LIB_RX_TIMEOUT))
+        {
+            LocLibRxCommit();
         }
     };
 
     /**
-     * Keep alive.
+     * Keep alive, request loc info only when no broadcast of the loc was received for a while.
      */
     void react(updateEvent3sec const&) override
     {
         if (m_locSelection == false)
         {
-            m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-            WmcCheckForDataTx();
+            RequestRefresh(requestLocInfo, m_locLib.GetActualLocAddress());
         }
     }
 
@@ -681,6 +763,8 @@ class statePowerOff : public wmcApp
                     m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
                 m_wmcTft.UpdateLocInfoSelect(m_locLib.GetActualLocAddress(), m_locLib.GetLocName());
                 m_locSelection = true;
+                LocCacheShow();
+                LocPrefetchStart(CheckPulseSwitchRevert(CheckPulseSwitchRevert(e.Delta)));
             }
             break;
         case pushedShort:
@@ -689,10 +773,7 @@ class statePowerOff : public wmcApp
             WmcCheckForDataTx();
             break;
         case pushedlong: transit<stateMainMenu1>(); break;
-        case released:
-            m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-            WmcCheckForDataTx();
-            break;
+        case released: RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress()); break;
         default: break;
         }
     }
@@ -709,51 +790,74 @@ class statePowerOn : public wmcApp
      */
     void entry() override
     {
-        m_locSelection              = false;
-        m_WmcLocSpeedRequestPending = false;
+        m_locSelection            = false;
+        m_WmcLocSpeedTxPending    = false;
+        m_WmcLocSpeedReplyPending = false;
         m_wmcTft.UpdateStatus("POWER ON", false, WmcTft::color_green);
         m_wmcTft.UpdateSelectedAndNumberOfLocs(m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
     };
 
     /**
-     * Handle received data.
+     * A speed not transmitted yet is dropped when the track power changes, state changes requested by the operator
+     * transmit it before with LocSpeedFlush.
      */
-    void react(updateEvent5msec const&) override
+    void exit() override { m_WmcLocSpeedTxPending = false; };
+
+    /**
+     * Handle power status.
+     */
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::emergencyStop: transit<stateEmergencyStop>(); break;
         case Z21Slave::trackPowerOff: transit<statePowerOff>(); break;
         case Z21Slave::programmingMode: transit<statePowerProgrammingMode>(); break;
-        case Z21Slave::locinfo:
-            updateLocInfoOnScreen(false);
-            m_WmcLocSpeedRequestPending = false;
-            m_locLib.SpeedUpdate(m_WmcLocInfoReceived->Speed);
-            if (m_WmcLocInfoReceived->Direction == Z21Slave::locDirectionForward)
-            {
-                m_locLib.DirectionSet(directionForward);
-            }
-            else
-            {
-                m_locLib.DirectionSet(directionBackWard);
-            }
-            break;
-        case Z21Slave::locLibraryData: break;
         default: break;
         }
     };
 
-    void react(updateEvent50msec const&) override {}
+    /**
+     * Handle loc data.
+     */
+    void react(z21LocInfoEvent const&) override
+    {
+        if ((updateLocInfo(false) == true) && (LocCacheProvisionalEnd() == true))
+        {
+            m_wmcTft.UpdateStatus("POWER ON", false, WmcTft::color_green);
+        }
+    }
+
+    /**
+     * Transmit latest speed and check for response on transmitted speed, request loc info of the locs next to the
+     * selected loc and fill the loc cache after start up.
+     */
+    void react(updateEvent5msec const&) override
+    {
+        LocSpeedTransmit();
+        LocPrefetch();
+
+        if (LocWarmUp() == true)
+        {
+            m_wmcTft.UpdateStatus("POWER ON", false, WmcTft::color_green);
+        }
+
+        if ((m_WmcLocSpeedReplyPending == true) && ((millis() - m_WmcLocSpeedTxTime) >= LOC_SPEED_REPLY_TIMEOUT))
+        {
+            /* No loc info received on transmitted speed, request it. */
+            m_WmcLocSpeedReplyPending = false;
+            RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress());
+        }
+    };
 
     /**
-     * Request loc info if for some reason no repsonse was received.
+     * Request loc info again if for some reason no repsonse was received.
      */
     void react(updateEvent500msec const&)
     {
         if (m_locSelection == false)
         {
-            m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-            WmcCheckForDataTx();
+            RequestRetry(requestLocInfo);
         }
     };
 
@@ -770,23 +874,31 @@ class statePowerOn : public wmcApp
             /* Select next or previous loc. */
             if (CheckPulseSwitchRevert(e.Delta) != 0)
             {
+                /* Speed not yet transmitted belongs to the actual loc, transmit it before selecting another one. */
+                LocSpeedFlush();
+
                 m_locLib.GetNextLoc(CheckPulseSwitchRevert(CheckPulseSwitchRevert(e.Delta)));
                 m_wmcTft.UpdateSelectedAndNumberOfLocs(
                     m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
                 m_wmcTft.UpdateLocInfoSelect(m_locLib.GetActualLocAddress(), m_locLib.GetLocName());
                 m_locSelection = true;
+                LocCacheShow();
+                LocPrefetchStart(CheckPulseSwitchRevert(CheckPulseSwitchRevert(e.Delta)));
             }
             break;
         case turn:
-            /* Increase or decrease speed. */
-            if (m_WmcLocSpeedRequestPending == false)
+            /* Increase or decrease speed, always keep the latest speed and transmit it with a limited rate. */
+            Speed = m_locLib.SpeedSet(CheckPulseSwitchRevert(e.Delta));
+            if (Speed != 0xFFFF)
             {
-                Speed = m_locLib.SpeedSet(CheckPulseSwitchRevert(e.Delta));
-                if (Speed != 0xFFFF)
-                {
-                    m_WmcLocSpeedRequestPending = true;
-                    PrepareLanXSetLocoDriveAndTransmit(Speed);
-                }
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+                m_LatencyStart         = micros();
+                m_LatencyWirePending   = true;
+                m_LatencyScreenPending = true;
+#endif
+                m_WmcLocSpeedTarget    = Speed;
+                m_WmcLocSpeedTxPending = true;
+                LocSpeedTransmit();
             }
             break;
         case pushedShort:
@@ -803,14 +915,12 @@ class statePowerOn : public wmcApp
             PrepareLanXSetLocoDriveAndTransmit(m_locLib.SpeedGet());
             break;
         case pushedlong:
+            LocSpeedFlush();
             m_CvPomProgramming            = true;
             m_CvPomProgrammingFromPowerOn = true;
             transit<stateCvProgramming>();
             break;
-        case released:
-            m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-            WmcCheckForDataTx();
-            break;
+        case released: RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress()); break;
         }
     };
 
@@ -856,6 +966,7 @@ class statePowerOn : public wmcApp
             WmcCheckForDataTx();
             break;
         case button_5:
+            LocSpeedFlush();
             m_wmcTft.Clear();
             transit<stateTurnoutControl>();
             break;
@@ -874,45 +985,50 @@ class stateEmergencyStop : public wmcApp
      */
     void entry() override
     {
-        m_locSelection              = false;
-        m_WmcLocSpeedRequestPending = false;
+        m_locSelection            = false;
+        m_WmcLocSpeedTxPending    = false;
+        m_WmcLocSpeedReplyPending = false;
         m_wmcTft.UpdateStatus("POWER ON", false, WmcTft::color_yellow);
         m_wmcTft.UpdateSelectedAndNumberOfLocs(m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
 
-        /* Force speed to zero on screen. */
+        /* Force speed to zero on screen. The last decoded loc info may be of another loc, so use the cached loc info
+           of the actual loc, or request it when it's not cached. */
         m_locLib.SpeedUpdate(0);
-        updateLocInfoOnScreen(false);
+        if (LocCacheGet(m_locLib.GetActualLocAddress()) != NULL)
+        {
+            m_WmcLocInfoReceived = LocCacheGet(m_locLib.GetActualLocAddress());
+            updateLocInfoOnScreen(false);
+        }
+        else
+        {
+            RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress());
+        }
     };
 
     /**
-     * Handle received data.
+     * Handle power status.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff: transit<statePowerOff>(); break;
         case Z21Slave::trackPowerOn: transit<statePowerOn>(); break;
-        case Z21Slave::emergencyStop: break;
-        case Z21Slave::programmingMode: break;
-        case Z21Slave::locinfo:
-            updateLocInfoOnScreen(false);
-            m_WmcLocSpeedRequestPending = false;
-            m_locLib.SpeedUpdate(m_WmcLocInfoReceived->Speed);
-            if (m_WmcLocInfoReceived->Direction == Z21Slave::locDirectionForward)
-            {
-                m_locLib.DirectionSet(directionForward);
-            }
-            else
-            {
-                m_locLib.DirectionSet(directionBackWard);
-            }
-            break;
-        case Z21Slave::locLibraryData: break;
         default: break;
         }
     };
 
+    /**
+     * Handle loc data.
+     */
+    void react(z21LocInfoEvent const&) override
+    {
+        if ((updateLocInfo(false) == true) && (LocCacheProvisionalEnd() == true))
+        {
+            m_wmcTft.UpdateStatus("POWER ON", false, WmcTft::color_yellow);
+        }
+    }
+
     /**
      * Handle pulse switch events.
      */
@@ -984,11 +1100,11 @@ class statePowerProgrammingMode : public wmcApp
     };
 
     /**
-     * Handle received data.
+     * Handle power status.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff: transit<statePowerOff>(); break;
         case Z21Slave::trackPowerOn: transit<statePowerOn>(); break;
@@ -1037,16 +1153,22 @@ class stateTurnoutControl : public wmcApp
     };
 
     /**
-     * Handle received data.
+     * Handle power status.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff: transit<stateTurnoutControlPowerOff>(); break;
         default: break;
         }
+    };
 
+    /**
+     * Handle turnout off command.
+     */
+    void react(updateEvent50msec const&) override
+    {
         /* When turnout active sent after about 500msec off command. */
         if ((m_TurnOutDirection == Z21Slave::Z21Slave::directionForward)
             || (m_TurnOutDirection == Z21Slave::Z21Slave::directionTurn))
@@ -1178,6 +1300,7 @@ class stateTurnoutControl : public wmcApp
             m_z21Slave.LanXSetTurnout(m_TurnOutAddress - 1, m_TurnOutDirection);
             WmcCheckForDataTx();
             m_wmcTft.ShowTurnoutDirection(static_cast<uint8_t>(m_TurnOutDirection));
+            JournalSet(journalTurnoutAddress, m_TurnOutAddress);
         }
     };
 
@@ -1216,11 +1339,11 @@ class stateTurnoutControlPowerOff : public wmcApp
     };
 
     /**
-     * Handle received data.
+     * Handle power status.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff: break;
         case Z21Slave::trackPowerOn:
@@ -1470,7 +1593,7 @@ class stateMenuLocAdd : public wmcApp
         case pushedlong:
             /* If loc is not present goto add functions else red address indicating
              * loc already present. */
-            if (m_locLib.CheckLoc(m_locAddressAdd) != 255)
+            if (LocIndexFind(m_locAddressAdd) != LOC_INDEX_NONE)
             {
                 m_wmcTft.ShowlocAddress(m_locAddressAdd, WmcTft::color_red);
             }
@@ -1501,7 +1624,7 @@ class stateMenuLocAdd : public wmcApp
         case button_5:
             /* If loc is not present goto add functions else red address indicating
              * loc already present. */
-            if (m_locLib.CheckLoc(m_locAddressAdd) != 255)
+            if (LocIndexFind(m_locAddressAdd) != LOC_INDEX_NONE)
             {
                 updateScreen = false;
                 m_wmcTft.ShowlocAddress(m_locAddressAdd, WmcTft::color_red);
@@ -1554,6 +1677,8 @@ class stateMenuLocFunctionsAdd : public wmcApp
      */
     void react(pulseSwitchEvent const& e) override
     {
+        bool SortRequired;
+
         switch (e.Status)
         {
         case turn:
@@ -1581,9 +1706,14 @@ class stateMenuLocFunctionsAdd : public wmcApp
             }
             break;
         case pushedNormal:
-            /* Store loc functions */
+            /* Store loc functions, sort only when the loc is not added at the right position. */
+            SortRequired = LocSortRequired(m_locAddressAdd);
             m_locLib.StoreLoc(m_locAddressAdd, m_locFunctionAssignment, NULL, LocLib::storeAdd);
-            m_locLib.LocBubbleSort();
+            if (SortRequired == true)
+            {
+                m_locLib.LocBubbleSort();
+            }
+            m_LocIndexValid = false;
             m_locAddressAdd++;
             transit<stateMenuLocAdd>();
             break;
@@ -1596,6 +1726,8 @@ class stateMenuLocFunctionsAdd : public wmcApp
      */
     void react(pushButtonsEvent const& e) override
     {
+        bool SortRequired;
+
         switch (e.Button)
         {
         case button_0:
@@ -1618,9 +1750,14 @@ class stateMenuLocFunctionsAdd : public wmcApp
             break;
         case button_power: transit<stateMainMenu1>(); break;
         case button_5:
-            /* Store loc functions */
+            /* Store loc functions, sort only when the loc is not added at the right position. */
+            SortRequired = LocSortRequired(m_locAddressAdd);
             m_locLib.StoreLoc(m_locAddressAdd, m_locFunctionAssignment, NULL, LocLib::storeAdd);
-            m_locLib.LocBubbleSort();
+            if (SortRequired == true)
+            {
+                m_locLib.LocBubbleSort();
+            }
+            m_LocIndexValid = false;
             m_locAddressAdd++;
             transit<stateMenuLocAdd>();
             break;
@@ -1802,6 +1939,7 @@ class stateMenuLocDelete : public wmcApp
             {
                 m_wmcTft.UpdateStatus("DELETING", false, WmcTft::color_red);
                 m_locLib.RemoveLoc(m_locAddressDelete);
+                m_LocIndexValid = false;
                 m_wmcTft.UpdateSelectedAndNumberOfLocs(
                     m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
                 m_locAddressDelete = m_locLib.GetActualLocAddress();
@@ -1851,8 +1989,9 @@ class stateMenuTransmitLocDatabase : public wmcApp
 {
     void entry() override
     {
-        m_locDbDataTransmitCnt       = 0;
-        m_locDbDataTransmitCntRepeat = 0;
+        m_locDbDataTransmitCnt  = 0;
+        m_locDbDataTransmitPass = 0;
+        m_locDbDataTransmitTime = millis() - APP_CFG_LOC_DB_TX_INTERVAL;
         m_wmcTft.UpdateStatus("SEND LOC DATA", true, WmcTft::color_white);
 
         /* Update status row. */
@@ -1878,35 +2017,47 @@ class stateMenuTransmitLocDatabase : public wmcApp
     }
 
     /**
-     * Transmit loc data.
+     * Transmit loc data, each loc is transmitted in its own packet.
      */
-    void react(updateEvent100msec const&)
+    void react(updateEvent5msec const&) override
     {
         LocLibData* LocDbData;
+        uint8_t Entries = 0;
 
-        /* The loc database needs to be transmitted twice.. */
-        if (m_locDbDataTransmitCntRepeat > 2)
+        if ((millis() - m_locDbDataTransmitTime) >= APP_CFG_LOC_DB_TX_INTERVAL)
         {
-            m_locDbDataTransmitCntRepeat = 1;
-            m_locDbDataTransmitCnt++;
+            m_locDbDataTransmitTime = millis();
+
+            while ((Entries < APP_CFG_LOC_DB_TX_ENTRIES_PER_INTERVAL)
+                && (m_locDbDataTransmitCnt < m_locLib.GetNumberOfLocs()))
+            {
+                LocDbData = m_locLib.LocGetAllDataByIndex(m_locDbDataTransmitCnt);
+                m_z21Slave.LanXLocLibDataTransmit(LocDbData->Addres, m_locDbDataTransmitCnt,
+                    static_cast<uint8_t>(m_locLib.GetNumberOfLocs()), LocDbData->Name);
+                WmcCheckForDataTx();
+                WmcTxFlush();
+
+                m_locDbDataTransmitCnt++;
+                Entries++;
+            }
 
             /* Update status row. */
             m_wmcTft.UpdateTransmitCount(
-                static_cast<uint8_t>(m_locDbDataTransmitCnt + 1), static_cast<uint8_t>(m_locLib.GetNumberOfLocs()));
-        }
-        m_locDbDataTransmitCntRepeat++;
+                static_cast<uint8_t>(m_locDbDataTransmitCnt), static_cast<uint8_t>(m_locLib.GetNumberOfLocs()));
 
-        // If last loc transmitted back to menu else transmit loc data,
-        if (m_locDbDataTransmitCnt >= m_locLib.GetNumberOfLocs())
-        {
-            transit<stateMainMenu2>();
-        }
-        else
-        {
-            LocDbData = m_locLib.LocGetAllDataByIndex(m_locDbDataTransmitCnt);
-            m_z21Slave.LanXLocLibDataTransmit(LocDbData->Addres, m_locDbDataTransmitCnt,
-                static_cast<uint8_t>(m_locLib.GetNumberOfLocs()), LocDbData->Name);
-            WmcCheckForDataTx();
+            // If last loc of last pass transmitted back to menu else start next pass.
+            if (m_locDbDataTransmitCnt >= m_locLib.GetNumberOfLocs())
+            {
+                m_locDbDataTransmitPass++;
+                if (m_locDbDataTransmitPass >= APP_CFG_LOC_DB_TX_REPEAT)
+                {
+                    transit<stateMainMenu2>();
+                }
+                else
+                {
+                    m_locDbDataTransmitCnt = 0;
+                }
+            }
         }
     }
 
@@ -1939,7 +2090,11 @@ class stateCommandLineInterfaceActive : public wmcApp
      */
     void entry() override
     {
+        WmcTxFlush();
         m_WifiUdp.stop();
+
+        /* Locs may be changed using the command line. */
+        m_LocIndexValid = false;
         m_wmcTft.Clear();
         m_wmcTft.UpdateStatus("COMMAND LINE", true, WmcTft::color_green);
         m_wmcTft.CommandLine();
@@ -1975,15 +2130,13 @@ class stateCvProgramming : public wmcApp
     };
 
     /**
-     * Handle received Z21 data.
+     * Handle power status.
      */
-    void react(updateEvent50msec const&) override
+    void react(z21TrackPowerEvent const& e) override
     {
-        cvEvent EventCv;
         cvpushButtonEvent ButtonEvent;
-        Z21Slave::cvData* cvDataPtr = NULL;
 
-        switch (WmcCheckForDataRx())
+        switch (e.Status)
         {
         case Z21Slave::trackPowerOff:
             m_TrackPower = powerState::off;
@@ -2000,31 +2153,39 @@ class stateCvProgramming : public wmcApp
                 transit<stateInitLocInfoGet>();
             }
             break;
-        case Z21Slave::programmingCvNackSc:
-            EventCv.EventData = cvNack;
-            send_event(EventCv);
-            break;
-        case Z21Slave::programmingCvResult:
-            cvDataPtr = m_z21Slave.LanXCvResult();
-
-            EventCv.EventData = cvData;
-            EventCv.cvNumber  = cvDataPtr->Number;
-            EventCv.cvValue   = cvDataPtr->Value;
-            send_event(EventCv);
-            break;
         default: break;
         }
     };
 
+    /**
+     * Handle CV programming failure.
+     */
+    void react(z21CvNackEvent const&) override
+    {
+        cvEvent EventCv;
+
+        EventCv.EventData = cvNack;
+        send_event(EventCv);
+    };
+
+    /**
+     * Handle CV programming result.
+     */
+    void react(z21CvResultEvent const& e) override
+    {
+        cvEvent EventCv;
+
+        EventCv.EventData = cvData;
+        EventCv.cvNumber  = e.DataPtr->Number;
+        EventCv.cvValue   = e.DataPtr->Value;
+        send_event(EventCv);
+    };
+
     /**
      * Keep alive by requesting loc status. Requesting power system status forces
      * the CV mode back to normal mode...
      */
-    void react(updateEvent3sec const&) override
-    {
-        m_z21Slave.LanXGetLocoInfo(m_locLib.GetActualLocAddress());
-        WmcCheckForDataTx();
-    }
+    void react(updateEvent3sec const&) override { RequestRefresh(requestLocInfo, m_locLib.GetActualLocAddress()); }
 
     /**
      * Handle pulse switch events.
@@ -2126,7 +2287,7 @@ class stateCvProgramming : public wmcApp
 void wmcApp::react(pulseSwitchEvent const&){};
 void wmcApp::react(pushButtonsEvent const&){};
 void wmcApp::react(updateEvent5msec const&){};
-void wmcApp::react(updateEvent50msec const&) { WmcCheckForDataRx(); };
+void wmcApp::react(updateEvent50msec const&){};
 void wmcApp::react(updateEvent100msec const&)
 {
     bool Found    = false;
@@ -2182,13 +2343,14 @@ void wmcApp::react(updateEvent100msec const&)
 };
 
 void wmcApp::react(updateEvent500msec const&){};
-void wmcApp::react(updateEvent3sec const&)
-{
-    m_z21Slave.LanGetStatus();
-    WmcCheckForDataTx();
-};
+void wmcApp::react(updateEvent3sec const&) { RequestRefresh(requestStatus, 0); };
 void wmcApp::react(cliEnterEvent const&) { transit<stateCommandLineInterfaceActive>(); };
 void wmcApp::react(cvProgEvent const&){};
+void wmcApp::react(z21TrackPowerEvent const&){};
+void wmcApp::react(z21LocInfoEvent const&){};
+void wmcApp::react(z21LocLibDataEvent const&){};
+void wmcApp::react(z21CvNackEvent const&){};
+void wmcApp::react(z21CvResultEvent const&){};
 
 /***********************************************************************************************************************
  * Initial state.
@@ -2196,62 +2358,322 @@ void wmcApp::react(cvProgEvent const&){};
 FSM_INITIAL_STATE(wmcApp, stateInit)
 
 /***********************************************************************************************************************
- * Check for received Z21 data and process it.
+ * Check for a received packet. The data of the packet stays in the buffer of the network stack and is read frame by
+ * frame.
  */
-Z21Slave::dataType wmcApp::WmcCheckForDataRx(void)
+bool wmcApp::WmcRxPacketRead(void)
 {
-    int WmcPacketBufferLength     = 0;
-    Z21Slave::dataType returnData = Z21Slave::none;
-#if WMC_APP_DEBUG_TX_RX == 1
-    uint8_t Index;
-#endif
-
-    if (m_WifiUdp.parsePacket())
+    m_WmcPacketRemaining = m_WifiUdp.parsePacket();
+    if (m_WmcPacketRemaining > 0)
+    {
+        m_RxPacketsTick++;
+    }
+    else
     {
-        // We've received a packet, read the data from it into the buffer
-        WmcPacketBufferLength = m_WifiUdp.read(m_WmcPacketBuffer, 40);
+        m_WmcPacketRemaining = 0;
+    }
 
-        if (WmcPacketBufferLength != 0)
-        {
-#if WMC_APP_DEBUG_TX_RX == 1
-            Serial.print("RX : ");
+    return (m_WmcPacketRemaining > 0);
+}
 
-            for (Index = 0; Index < WmcPacketBufferLength; Index++)
-            {
-                Serial.print(m_WmcPacketBuffer[Index], HEX);
-                Serial.print(" ");
-            }
+/***********************************************************************************************************************
+ * Read data of the actual packet from the network stack directly into the frame buffer.
+ */
+bool wmcApp::WmcRxFrameRead(uint8_t* DataPtr, uint16_t Length)
+{
+    int Read = m_WifiUdp.read(DataPtr, Length);
 
-            Serial.println("");
-#endif
-            // Process the data.
-            returnData = m_z21Slave.ProcesDataRx(m_WmcPacketBuffer, sizeof(m_WmcPacketBuffer));
-        }
+    m_WmcPacketRemaining -= Length;
+    if (Read > 0)
+    {
+        m_RxBytesCopied += Read;
     }
 
-    return (returnData);
+    return (Read == Length);
 }
 
 /***********************************************************************************************************************
- * Check for data to be transmitted.
+ * Skip data of the actual packet, the data is read in parts into the given buffer and dropped.
  */
-void wmcApp::WmcCheckForDataTx(void)
+bool wmcApp::WmcRxFrameSkip(uint8_t* BufferPtr, uint16_t BufferSize, uint16_t Length)
 {
-    uint8_t* DataTransmitPtr;
-    IPAddress WmcUdpIp(m_IpAddresZ21[0], m_IpAddresZ21[1], m_IpAddresZ21[2], m_IpAddresZ21[3]);
-
-#if WMC_APP_DEBUG_TX_RX == 1
-    uint8_t Index;
-#endif
+    bool Result = true;
+    uint16_t Part;
+
+    while ((Length > 0) && (Result == true))
+    {
+        Part   = (Length < BufferSize) ? Length : BufferSize;
+        Result = WmcRxFrameRead(BufferPtr, Part);
+        Length -= Part;
+    }
+
+    return (Result);
+}
+
+/***********************************************************************************************************************
+ * Check whether a frame is a loc info of a loc which is not present in the loc library. Only the header and address
+ * bytes are checked. Loc info of other locs of the loc library is decoded for the loc cache.
+ */
+bool wmcApp::WmcRxLocInfoFilter(uint8_t* FramePtr, uint16_t FrameLength)
+{
+    bool Result      = false;
+    uint16_t Address = 0;
+
+    if ((FrameLength >= Z21_LOCO_INFO_LENGTH_MIN) && (FramePtr[2] == Z21_HEADER_LAN_X) && (FramePtr[3] == 0)
+        && (FramePtr[4] == Z21_X_HEADER_LOCO_INFO))
+    {
+        Address = (static_cast<uint16_t>(FramePtr[5] & 0x3F) << 8) | FramePtr[6];
+
+        if (LocIndexFind(Address) == LOC_INDEX_NONE)
+        {
+            Result = true;
+        }
+    }
+
+    return (Result);
+}
+
+/***********************************************************************************************************************
+ * Check whether a loc is the actual loc, only loc info of this loc is dispatched to the states.
+ */
+bool wmcApp::WmcRxLocInfoWatched(uint16_t Address)
+{
+    return (Address == m_locLib.GetActualLocAddress());
+}
+
+/***********************************************************************************************************************
+ * Read, decode and dispatch the frames of up to RX_PACKETS_PER_TICK_MAX received packets. A packet may contain several
+ * Z21 frames, a frame with an invalid length ends the processing of the packet and the rest of the packet is dropped
+ * by the network stack on the next packet check. A valid frame longer than the frame buffer (e.g. LocoNet data) is
+ * skipped. Each frame is forwarded as event to the actual state before the next frame is read, so a state change
+ * caused by a frame is also applied for the next frames.
+ */
+void wmcApp::WmcRxReceive(void)
+{
+    uint16_t FrameLength = 0;
+    bool FrameValid      = false;
+    bool FrameSkipped    = false;
+
+    m_RxPacketsTick = 0;
+
+    while (1)
+    {
+        if (m_WmcPacketRemaining <= 0)
+        {
+            /* All frames of the previous packet processed, check for next packet if allowed. */
+            if ((m_RxPacketsTick >= RX_PACKETS_PER_TICK_MAX) || (WmcRxPacketRead() == false))
+            {
+                break;
+            }
+        }
+
+        /* First two bytes of a frame contain the length of the frame including the length bytes. */
+        FrameValid   = false;
+        FrameSkipped = false;
+        if ((m_WmcPacketRemaining >= Z21_FRAME_LENGTH_MIN) && (WmcRxFrameRead(m_RxFrame, 2) == true))
+        {
+            FrameLength = static_cast<uint16_t>(m_RxFrame[0]);
+            FrameLength |= static_cast<uint16_t>(m_RxFrame[1]) << 8;
+
+            if ((FrameLength >= Z21_FRAME_LENGTH_MIN) && ((FrameLength - 2) <= m_WmcPacketRemaining))
+            {
+                if (FrameLength <= sizeof(m_RxFrame))
+                {
+                    FrameValid = WmcRxFrameRead(&m_RxFrame[2], FrameLength - 2);
+                }
+                else
+                {
+                    FrameValid   = WmcRxFrameSkip(m_RxFrame, sizeof(m_RxFrame), FrameLength - 2);
+                    FrameSkipped = true;
+                }
+            }
+        }
+
+        if (FrameValid == false)
+        {
+            m_RxFrameErrorCnt++;
+            m_WmcPacketRemaining = 0;
+        }
+        else if (FrameSkipped == true)
+        {
+            /* Only frames not used by the WMC (e.g. LocoNet data) are that long, continue with the next frame. */
+            m_RxFrameSkipCnt++;
+        }
+        else if (WmcRxLocInfoFilter(m_RxFrame, FrameLength) == true)
+        {
+            /* Loc info of a loc not in the loc library, skip decoding. */
+            m_RxLocInfoFiltered++;
+        }
+        else
+        {
+            WmcRxFrameDecode(FrameLength);
+        }
+    }
+
+    /* Update statistics. */
+    if (m_RxPacketsTick > m_RxPacketsTickMax)
+    {
+        m_RxPacketsTickMax = m_RxPacketsTick;
+    }
+
+    if (m_RxPacketsTick >= RX_PACKETS_PER_TICK_MAX)
+    {
+        m_RxBacklogCnt++;
+    }
+}
+
+/***********************************************************************************************************************
+ * Decode the received frame and forward the result as event to the actual state.
+ */
+void wmcApp::WmcRxFrameDecode(uint16_t Length)
+{
+    Z21Slave::dataType Data;
+#if WMC_APP_DEBUG_TX_RX == 1
+    uint16_t Index;
+#endif
+#if APP_CFG_EVENT_TIMING == 1
+    uint32_t Cycles;
+#endif
+
+#if WMC_APP_DEBUG_TX_RX == 1
+    Serial.print("RX : ");
+
+    for (Index = 0; Index < Length; Index++)
+    {
+        Serial.print(m_RxFrame[Index], HEX);
+        Serial.print(" ");
+    }
+
+    Serial.println("");
+#endif
+#if APP_CFG_EVENT_TIMING == 1
+    Cycles = ESP.getCycleCount();
+#endif
+    // Process the data.
+    Data = m_z21Slave.ProcesDataRx(m_RxFrame, Length);
+#if APP_CFG_EVENT_TIMING == 1
+    m_RxFrameCycles += ESP.getCycleCount() - Cycles;
+    m_RxFrames++;
+#endif
+
+    WmcRxEventSend(Data);
+}
+
+/***********************************************************************************************************************
+ * Convert the decoded Z21 data into the matching event and dispatch it.
+ */
+void wmcApp::WmcRxEventSend(Z21Slave::dataType Data)
+{
+    z21TrackPowerEvent TrackPowerEvent;
+    z21LocInfoEvent LocInfoEvent;
+    z21LocLibDataEvent LocLibDataEvent;
+    z21CvNackEvent CvNackEvent;
+    z21CvResultEvent CvResultEvent;
+
+    switch (Data)
+    {
+    case Z21Slave::trackPowerOff:
+    case Z21Slave::trackPowerOn:
+    case Z21Slave::programmingMode:
+    case Z21Slave::emergencyStop:
+        RequestResponse(requestStatus, 0);
+        TrackPowerEvent.Status = Data;
+        send_event(TrackPowerEvent);
+        break;
+    case Z21Slave::locinfo:
+        LocInfoEvent.InfoPtr = m_z21Slave.LanXLocoInfo();
+        RequestResponse(requestLocInfo, LocInfoEvent.InfoPtr->Address);
+        RequestResponse(requestPrefetch, LocInfoEvent.InfoPtr->Address);
+        LocCacheUpdate(LocInfoEvent.InfoPtr);
+
+        /* Loc info of other locs of the loc library is only cached. */
+        if (WmcRxLocInfoWatched(LocInfoEvent.InfoPtr->Address) == true)
+        {
+            m_WmcLocInfoReceived = LocInfoEvent.InfoPtr;
+            send_event(LocInfoEvent);
+        }
+        break;
+    case Z21Slave::locLibraryData:
+        LocLibDataEvent.DataPtr = m_z21Slave.LanXLocLibData();
+        send_event(LocLibDataEvent);
+        break;
+    case Z21Slave::programmingCvNackSc: send_event(CvNackEvent); break;
+    case Z21Slave::programmingCvResult:
+        CvResultEvent.DataPtr = m_z21Slave.LanXCvResult();
+        send_event(CvResultEvent);
+        break;
+    default: break;
+    }
+}
+
+/***********************************************************************************************************************
+ * Print the statistics of the received data on the serial port, shown with the event timing report.
+ */
+void wmcApp::WmcRxStatisticsPrint(void)
+{
+    Serial.print("RX loc info filtered ");
+    Serial.print(m_RxLocInfoFiltered);
+    Serial.print(" frame errors ");
+    Serial.print(m_RxFrameErrorCnt);
+    Serial.print(" skipped ");
+    Serial.print(m_RxFrameSkipCnt);
+    Serial.print(" max packets/tick ");
+    Serial.print(m_RxPacketsTickMax);
+    Serial.print(" backlog ");
+    Serial.println(m_RxBacklogCnt);
+}
+
+/***********************************************************************************************************************
+ * Administration of (nested) event dispatching. Received data is processed before each event from the main loop, so
+ * all states get received data with the rate of the fastest update event without polling themselves. Data to be
+ * transmitted is collected during the event and transmitted when the event is handled.
+ */
+void wmcApp::EventDispatchBegin(void)
+{
+    m_EventDispatchDepth++;
+
+    if (m_EventDispatchDepth == 1)
+    {
+        WmcRxReceive();
+    }
+}
+
+void wmcApp::EventDispatchEnd(void)
+{
+    if (m_EventDispatchDepth > 0)
+    {
+        m_EventDispatchDepth--;
+    }
+
+    /* Event completely handled, transmit collected data. */
+    if (m_EventDispatchDepth == 0)
+    {
+        WmcTxFlush();
+    }
+}
+
+/***********************************************************************************************************************
+ * Check for data to be transmitted. The data is added to the transmit buffer, all frames collected during the
+ * handling of an event are transmitted in one packet when the event is handled.
+ */
+void wmcApp::WmcCheckForDataTx(void)
+{
+    uint8_t* DataTransmitPtr;
+    uint8_t Length;
+
+#if WMC_APP_DEBUG_TX_RX == 1
+    uint8_t Index;
+#endif
 
     if (m_z21Slave.txDataPresent() == true)
     {
         DataTransmitPtr = m_z21Slave.GetDataTx();
+        Length          = DataTransmitPtr[0];
 
 #if WMC_APP_DEBUG_TX_RX == 1
         Serial.print("TX : ");
 
-        for (Index = 0; Index < DataTransmitPtr[0]; Index++)
+        for (Index = 0; Index < Length; Index++)
         {
             Serial.print(DataTransmitPtr[Index], HEX);
             Serial.print(" ");
@@ -2260,88 +2682,761 @@ void wmcApp::WmcCheckForDataTx(void)
         Serial.println("");
 #endif
 
+        if ((m_TxBufferLength + Length) > sizeof(m_TxBuffer))
+        {
+            WmcTxFlush();
+        }
+
+        memcpy(&m_TxBuffer[m_TxBufferLength], DataTransmitPtr, Length);
+        m_TxBufferLength += Length;
+        m_TxBufferFrames++;
+
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+        /* Only the drive command of the speed change ends the measurement, not other transmitted frames. */
+        if ((m_LatencyWirePending == true) && (Length > 5) && (DataTransmitPtr[2] == Z21_HEADER_LAN_X)
+            && (DataTransmitPtr[4] == Z21_X_HEADER_LOCO_DRIVE) && ((DataTransmitPtr[5] & 0xF0) == Z21_LOCO_DRIVE_DB0))
+        {
+            m_LatencyWireDriveQueued = true;
+        }
+#endif
+
+        /* Not called during event handling, transmit immediately. */
+        if (m_EventDispatchDepth == 0)
+        {
+            WmcTxFlush();
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * Transmit the collected frames in one packet.
+ */
+void wmcApp::WmcTxFlush(void)
+{
+    IPAddress WmcUdpIp(m_IpAddresZ21[0], m_IpAddresZ21[1], m_IpAddresZ21[2], m_IpAddresZ21[3]);
+
+    if (m_TxBufferLength > 0)
+    {
         m_WifiUdp.beginPacket(WmcUdpIp, m_UdpLocalPort);
-        m_WifiUdp.write(DataTransmitPtr, DataTransmitPtr[0]);
+        m_WifiUdp.write(m_TxBuffer, m_TxBufferLength);
         m_WifiUdp.endPacket();
+
+        /* Update statistics. */
+        m_TxPackets++;
+        m_TxFrames += m_TxBufferFrames;
+        if (m_TxBufferFrames > m_TxFramesPacketMax)
+        {
+            m_TxFramesPacketMax = m_TxBufferFrames;
+        }
+
+        m_TxBufferLength = 0;
+        m_TxBufferFrames = 0;
+        m_TxTime         = millis();
+
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+        if (m_LatencyWireDriveQueued == true)
+        {
+            m_LatencyWirePending     = false;
+            m_LatencyWireDriveQueued = false;
+            LatencyAdd(&m_LatencyWire, micros() - m_LatencyStart);
+        }
+#endif
+    }
+}
+
+/***********************************************************************************************************************
+ * Transmit a request. A request equal to the one waiting for a response is suppressed until its timeout is elapsed.
+ */
+void wmcApp::RequestTransmit(requestType Type, uint16_t Address)
+{
+    request* RequestPtr = &m_Requests[Type];
+
+    if ((RequestPtr->Pending == true) && (RequestPtr->Address == Address)
+        && ((millis() - RequestPtr->TxTime) < m_RequestTimeout[Type]))
+    {
+        RequestPtr->Suppressed++;
+    }
+    else
+    {
+        RequestPtr->Address = Address;
+        RequestPtr->Retries = 0;
+        RequestSend(Type);
+    }
+}
+
+/***********************************************************************************************************************
+ * Retransmit an outstanding request when its timeout is elapsed. Returns false when no response was received after
+ * the maximum number of retries, the request is dropped in that case.
+ */
+bool wmcApp::RequestRetry(requestType Type)
+{
+    bool Result         = true;
+    request* RequestPtr = &m_Requests[Type];
+
+    if ((RequestPtr->Pending == true) && ((millis() - RequestPtr->TxTime) >= m_RequestTimeout[Type]))
+    {
+        RequestPtr->Timeouts++;
+
+        if (RequestPtr->Retries < REQUEST_RETRIES_MAX)
+        {
+            RequestPtr->Retries++;
+            RequestSend(Type);
+        }
+        else
+        {
+            RequestPtr->Pending = false;
+            Result              = false;
+        }
+    }
+
+    return (Result);
+}
+
+/***********************************************************************************************************************
+ * Request data only when no update of it was received within APP_CFG_REQUEST_REFRESH_TIME, the control unit
+ * broadcasts changes of the power state and the active loc. Received broadcasts do not keep the connection alive,
+ * so the data is also requested when nothing was transmitted for TX_KEEP_ALIVE_TIME.
+ */
+void wmcApp::RequestRefresh(requestType Type, uint16_t Address)
+{
+    request* RequestPtr = &m_Requests[Type];
+
+    if ((RequestPtr->RxAddress != Address) || ((millis() - RequestPtr->RxTime) >= APP_CFG_REQUEST_REFRESH_TIME)
+        || ((millis() - m_TxTime) >= TX_KEEP_ALIVE_TIME))
+    {
+        RequestPtr->RxAddress = Address;
+        RequestTransmit(Type, Address);
+    }
+    else
+    {
+        RequestPtr->PollsAvoided++;
+    }
+}
+
+/***********************************************************************************************************************
+ * Response or broadcast received, stop waiting for it and update the round trip time. Only data of the refreshed
+ * address counts as update, loc info of other locs (e.g. prefetched locs) does not.
+ */
+void wmcApp::RequestResponse(requestType Type, uint16_t Address)
+{
+    uint32_t RoundTripTime;
+    request* RequestPtr = &m_Requests[Type];
+
+    if (RequestPtr->RxAddress == Address)
+    {
+        RequestPtr->RxTime = millis();
+    }
+
+    if ((RequestPtr->Pending == true) && (RequestPtr->Address == Address))
+    {
+        RoundTripTime       = millis() - RequestPtr->TxTime;
+        RequestPtr->Pending = false;
+        RequestPtr->Responses++;
+        RequestPtr->RoundTripTotal += RoundTripTime;
+        if (RoundTripTime > RequestPtr->RoundTripMax)
+        {
+            RequestPtr->RoundTripMax = RoundTripTime;
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * Transmit the Z21 message of a request. Each loc info request subscribes the client to the broadcasts of the loc,
+ * the number of locs subscribed after the active loc is counted so prefetching does not remove its subscription.
+ */
+void wmcApp::RequestSend(requestType Type)
+{
+    request* RequestPtr = &m_Requests[Type];
+
+    switch (Type)
+    {
+    case requestStatus: m_z21Slave.LanGetStatus(); break;
+    case requestLocInfo:
+        m_z21Slave.LanXGetLocoInfo(RequestPtr->Address);
+        m_LocSubscriptions = 0;
+        break;
+    case requestPrefetch:
+        m_z21Slave.LanXGetLocoInfo(RequestPtr->Address);
+        m_LocSubscriptions++;
+        break;
+    default: break;
+    }
+
+    WmcCheckForDataTx();
+
+    RequestPtr->Pending = true;
+    RequestPtr->TxTime  = millis();
+}
+
+/***********************************************************************************************************************
+ * Read the journal and get the latest value of each key. Of the JOURNAL_SECTORS sectors the one with a valid header
+ * and the newest sequence number holds the latest values. After the header each record is a 32 bit word, the first
+ * erased word is the position for the next record. Without a valid sector (e.g. just flashed) the first write
+ * compacts into sector 0. The journal is only used when the flash layout has a file system area of at least
+ * JOURNAL_SECTORS sectors, so it never overlaps the program or OTA area.
+ */
+void wmcApp::JournalInit(void)
+{
+#if APP_CFG_JOURNAL == 1
+    uint32_t Block[16];
+    uint16_t Offset;
+    uint8_t Index;
+    uint8_t Key;
+    uint16_t Value;
+    uint16_t Sequence;
+    uint8_t Sector;
+    bool Valid = false;
+    bool Scan;
+
+    m_JournalValid    = 0;
+    m_JournalSector   = JOURNAL_SECTORS - 1;
+    m_JournalSequence = 0;
+    m_JournalOffset   = JOURNAL_SECTOR_SIZE;
+    m_JournalFlash    = ((reinterpret_cast<uint32_t>(&_FS_end) - reinterpret_cast<uint32_t>(&_FS_start))
+        >= (static_cast<uint32_t>(JOURNAL_SECTORS) * JOURNAL_SECTOR_SIZE));
+
+    if (m_JournalFlash == true)
+    {
+        for (Sector = 0; Sector < JOURNAL_SECTORS; Sector++)
+        {
+            ESP.flashRead(JournalAddress(Sector), Block, sizeof(Block[0]));
+            Sequence = static_cast<uint16_t>(Block[0] & 0xFFFF);
+
+            if (((Block[0] >> 16) == JOURNAL_MAGIC)
+                && ((Valid == false) || (static_cast<int16_t>(Sequence - m_JournalSequence) > 0)))
+            {
+                m_JournalSector   = Sector;
+                m_JournalSequence = Sequence;
+                Valid             = true;
+            }
+        }
+    }
+
+    /* Records of the sector in use, the first word is the header. */
+    Scan = Valid;
+    for (Offset = 0; (Offset < JOURNAL_SECTOR_SIZE) && (Scan == true); Offset += sizeof(Block))
+    {
+        ESP.flashRead(JournalAddress(m_JournalSector) + Offset, Block, sizeof(Block));
+
+        for (Index = (Offset == 0) ? 1 : 0; (Index < (sizeof(Block) / sizeof(Block[0]))) && (Scan == true); Index++)
+        {
+            Key   = static_cast<uint8_t>(Block[Index] & 0xFF);
+            Value = static_cast<uint16_t>(Block[Index] >> 8);
+
+            if (Block[Index] == 0xFFFFFFFF)
+            {
+                m_JournalOffset = Offset + (Index * sizeof(Block[0]));
+                Scan            = false;
+            }
+            else if ((Key < journalKeys) && (JournalRecord(Key, Value) == Block[Index]))
+            {
+                m_JournalValues[Key] = Value;
+                m_JournalValid |= static_cast<uint8_t>(1 << Key);
+            }
+        }
+    }
+#endif
+}
+
+/***********************************************************************************************************************
+ * Get a value of the journal, returns Default when the value was never stored.
+ */
+uint16_t wmcApp::JournalGet(journalKey Key, uint16_t Default)
+{
+    uint16_t Value = Default;
+
+    if ((m_JournalValid & (1 << Key)) != 0)
+    {
+        Value = m_JournalValues[Key];
+    }
+
+    return (Value);
+}
+
+/***********************************************************************************************************************
+ * Store a value by appending a record to the journal, only when the sector is full the latest values are compacted
+ * into the other sector. So a change costs programming one word instead of rewriting the EEPROM sector.
+ */
+void wmcApp::JournalSet(journalKey Key, uint16_t Value)
+{
+#if APP_CFG_JOURNAL == 1
+    uint32_t Record;
+#endif
+
+    if (((m_JournalValid & (1 << Key)) == 0) || (m_JournalValues[Key] != Value))
+    {
+        m_JournalValues[Key] = Value;
+        m_JournalValid |= static_cast<uint8_t>(1 << Key);
+
+#if APP_CFG_JOURNAL == 1
+        if (m_JournalFlash == true)
+        {
+            if (m_JournalOffset < JOURNAL_SECTOR_SIZE)
+            {
+                Record = JournalRecord(Key, Value);
+                ESP.flashWrite(JournalAddress(m_JournalSector) + m_JournalOffset, &Record, sizeof(Record));
+                m_JournalOffset += sizeof(Record);
+            }
+            else
+            {
+                JournalCompact();
+            }
+
+            m_JournalWrites++;
+        }
+#endif
+    }
+}
+
+#if APP_CFG_JOURNAL == 1
+/***********************************************************************************************************************
+ * Write the latest values into the other sector. Its header with the next sequence number is written last, so until
+ * the compacted copy is complete the old sector stays the valid one and a reset loses no values. The old sector is
+ * not erased, it is the destination of the next compaction.
+ */
+void wmcApp::JournalCompact(void)
+{
+    uint8_t Sector   = (m_JournalSector + 1) % JOURNAL_SECTORS;
+    uint32_t Address = JournalAddress(Sector);
+    uint32_t Record;
+    uint8_t Index;
+
+    ESP.flashEraseSector(Address / JOURNAL_SECTOR_SIZE);
+    m_JournalOffset = sizeof(Record);
+
+    for (Index = 0; Index < journalKeys; Index++)
+    {
+        if ((m_JournalValid & (1 << Index)) != 0)
+        {
+            Record = JournalRecord(Index, m_JournalValues[Index]);
+            ESP.flashWrite(Address + m_JournalOffset, &Record, sizeof(Record));
+            m_JournalOffset += sizeof(Record);
+        }
+    }
+
+    m_JournalSequence++;
+    Record = (static_cast<uint32_t>(JOURNAL_MAGIC) << 16) | m_JournalSequence;
+    ESP.flashWrite(Address, &Record, sizeof(Record));
+
+    m_JournalSector = Sector;
+    m_JournalCompactions++;
+}
+
+/***********************************************************************************************************************
+ * Flash address of a journal sector, the last JOURNAL_SECTORS sectors of the file system area. The linker symbols are
+ * addresses of the flash mapped at 0x40200000.
+ */
+uint32_t wmcApp::JournalAddress(uint8_t Sector)
+{
+    return ((reinterpret_cast<uint32_t>(&_FS_end) - 0x40200000)
+        - (static_cast<uint32_t>(JOURNAL_SECTORS - Sector) * JOURNAL_SECTOR_SIZE));
+}
+
+/***********************************************************************************************************************
+ * Compose a journal record: key, value and a check byte so partly programmed records are ignored.
+ */
+uint32_t wmcApp::JournalRecord(uint8_t Key, uint16_t Value)
+{
+    uint8_t Check = static_cast<uint8_t>(Key ^ (Value >> 8) ^ (Value & 0xFF) ^ 0xA5);
+
+    return (static_cast<uint32_t>(Key) | (static_cast<uint32_t>(Value) << 8) | (static_cast<uint32_t>(Check) << 24));
+}
+#endif
+
+/***********************************************************************************************************************
+ * Convert loc data to tft loc data.
+ */
+void wmcApp::convertLocDataToDisplayData(Z21Slave::locInfo* Z21DataPtr, WmcTft::locoInfo* TftDataPtr)
+{
+    TftDataPtr->Address = Z21DataPtr->Address;
+    TftDataPtr->Speed   = Z21DataPtr->Speed;
+
+    switch (Z21DataPtr->Steps)
+    {
+    case Z21Slave::locDecoderSpeedSteps14: TftDataPtr->Steps = WmcTft::locoDecoderSpeedSteps14; break;
+    case Z21Slave::locDecoderSpeedSteps28: TftDataPtr->Steps = WmcTft::locoDecoderSpeedSteps28; break;
+    case Z21Slave::locDecoderSpeedSteps128: TftDataPtr->Steps = WmcTft::locoDecoderSpeedSteps128; break;
+    case Z21Slave::locDecoderSpeedStepsUnknown: TftDataPtr->Steps = WmcTft::locoDecoderSpeedStepsUnknown; break;
+    }
+
+    switch (Z21DataPtr->Direction)
+    {
+    case Z21Slave::locDirectionForward: TftDataPtr->Direction = WmcTft::locoDirectionForward; break;
+    case Z21Slave::locDirectionBackward: TftDataPtr->Direction = WmcTft::locoDirectionBackward; break;
+    }
+
+    switch (Z21DataPtr->Light)
+    {
+    case Z21Slave::locLightOn: TftDataPtr->Light = WmcTft::locoLightOn; break;
+    case Z21Slave::locLightOff: TftDataPtr->Light = WmcTft::locoLightOff; break;
+    }
+
+    TftDataPtr->Functions = Z21DataPtr->Functions;
+    TftDataPtr->Occupied  = Z21DataPtr->Occupied;
+}
+
+/***********************************************************************************************************************
+ * Update loc info on screen with the loc info in m_WmcLocInfoReceived.
+ */
+bool wmcApp::updateLocInfoOnScreen(bool updateAll)
+{
+    uint8_t Index = 0;
+    bool Result   = true;
+    WmcTft::locoInfo locInfoActual;
+    WmcTft::locoInfo locInfoPrevious;
+
+    if (m_locLib.GetActualLocAddress() == m_WmcLocInfoReceived->Address)
+    {
+        switch (m_WmcLocInfoReceived->Steps)
+        {
+        case Z21Slave::locDecoderSpeedSteps14: m_locLib.DecoderStepsUpdate(decoderStep14); break;
+        case Z21Slave::locDecoderSpeedSteps28: m_locLib.DecoderStepsUpdate(decoderStep28); break;
+        case Z21Slave::locDecoderSpeedSteps128: m_locLib.DecoderStepsUpdate(decoderStep128); break;
+        case Z21Slave::locDecoderSpeedStepsUnknown: m_locLib.DecoderStepsUpdate(decoderStep28); break;
+        }
+
+        for (Index = 0; Index < 5; Index++)
+        {
+            m_locFunctionAssignment[Index] = m_locLib.FunctionAssignedGet(Index);
+        }
+
+        /* Invert functions so function symbols are updated if new loc is selected
+         * and set new direction. */
+        if (m_locSelection == true)
+        {
+            m_WmcLocInfoControl.Functions = ~m_WmcLocInfoReceived->Functions;
+        }
+
+        convertLocDataToDisplayData(m_WmcLocInfoReceived, &locInfoActual);
+        convertLocDataToDisplayData(&m_WmcLocInfoControl, &locInfoPrevious);
+        m_wmcTft.UpdateLocInfo(&locInfoActual, &locInfoPrevious, m_locFunctionAssignment, m_locLib.GetLocName(),
+            updateAll | m_locSelection);
+
+        memcpy(&m_WmcLocInfoControl, m_WmcLocInfoReceived, sizeof(Z21Slave::locInfo));
+        m_locSelection = false;
+
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+        if (m_LatencyScreenPending == true)
+        {
+            m_LatencyScreenPending = false;
+            LatencyAdd(&m_LatencyScreen, micros() - m_LatencyStart);
+        }
+#endif
+    }
+    else
+    {
+        Result = false;
+    }
+
+    return (Result);
+}
+
+/***********************************************************************************************************************
+ * Store received loc info in the loc cache, when the loc is not cached the least recently updated entry is replaced.
+ */
+void wmcApp::LocCacheUpdate(Z21Slave::locInfo* InfoPtr)
+{
+    uint8_t Index;
+    uint8_t IndexUse = 0;
+
+    for (Index = 0; Index < LOC_CACHE_SIZE; Index++)
+    {
+        if (m_LocCache[Index].Info.Address == InfoPtr->Address)
+        {
+            IndexUse = Index;
+            break;
+        }
+        else if ((millis() - m_LocCache[Index].RxTime) > (millis() - m_LocCache[IndexUse].RxTime))
+        {
+            IndexUse = Index;
+        }
+    }
+
+    memcpy(&m_LocCache[IndexUse].Info, InfoPtr, sizeof(Z21Slave::locInfo));
+    m_LocCache[IndexUse].RxTime = millis();
+}
+
+/***********************************************************************************************************************
+ * Get the cached loc info of a loc, returns NULL when the loc is not cached.
+ */
+Z21Slave::locInfo* wmcApp::LocCacheGet(uint16_t Address)
+{
+    Z21Slave::locInfo* InfoPtr = NULL;
+    uint8_t Index;
+
+    for (Index = 0; Index < LOC_CACHE_SIZE; Index++)
+    {
+        if ((m_LocCache[Index].Info.Address == Address) && (Address != 0))
+        {
+            InfoPtr = &m_LocCache[Index].Info;
+            break;
+        }
+    }
+
+    return (InfoPtr);
+}
+
+/***********************************************************************************************************************
+ * Show the cached loc info of a just selected loc, the loc info request on release of the pulse switch refreshes it.
+ * Speed and direction of loc info older than LOC_CACHE_MAX_AGE are not used for control, the loc info is only shown
+ * and marked as provisional in the status row until the loc info of the control unit is received.
+ */
+void wmcApp::LocCacheShow(void)
+{
+    uint32_t Age               = LocCacheAge(m_locLib.GetActualLocAddress());
+    Z21Slave::locInfo* InfoPtr = LocCacheGet(m_locLib.GetActualLocAddress());
+
+    if (InfoPtr == NULL)
+    {
+        m_LocCacheMisses++;
     }
+    else
+    {
+        /* Update statistics. */
+        m_LocCacheHits++;
+        m_LocCacheAgeTotal += Age;
+        if (Age > m_LocCacheAgeMax)
+        {
+            m_LocCacheAgeMax = Age;
+        }
+
+        m_WmcLocInfoReceived = InfoPtr;
+
+        if (Age < LOC_CACHE_MAX_AGE)
+        {
+            updateLocInfo(true);
+        }
+        else
+        {
+            updateLocInfoOnScreen(true);
+            m_wmcTft.UpdateStatus("LOC INFO OLD", false, WmcTft::color_yellow);
+            m_LocCacheProvisional = true;
+        }
+    }
+}
+
+/***********************************************************************************************************************
+ * End showing provisional loc info, returns true when the status row must be restored.
+ */
+bool wmcApp::LocCacheProvisionalEnd(void)
+{
+    bool Provisional = m_LocCacheProvisional;
+
+    m_LocCacheProvisional = false;
+
+    return (Provisional);
+}
+
+/***********************************************************************************************************************
+ * Start requesting the loc info of the locs next to the selected loc in the scroll direction.
+ */
+void wmcApp::LocPrefetchStart(int8_t Delta)
+{
+    m_LocPrefetchDirection = (Delta > 0) ? 1 : -1;
+    m_LocPrefetchCount     = 0;
+    m_LocPrefetchStartTime = millis();
+}
+
+/***********************************************************************************************************************
+ * Request the loc info of one loc next to the selected loc each LOC_PREFETCH_INTERVAL msec. First the locs in the
+ * scroll direction are requested, finally the loc on the other side. Locs with recently received loc info are
+ * skipped, as are all locs when the subscription of the active loc would be removed by the Z21. The responses are
+ * stored in the loc cache. After the last prefetch request the active loc is requested again to renew its
+ * subscription.
+ */
+void wmcApp::LocPrefetch(void)
+{
+    uint16_t NumberOfLocs = m_locLib.GetNumberOfLocs();
+    uint16_t Slot;
+    uint16_t Address;
+    int16_t Offset;
+
+    if ((m_LocPrefetchCount <= LOC_PREFETCH_DEPTH) && ((millis() - m_LocPrefetchTime) >= LOC_PREFETCH_INTERVAL))
+    {
+        Slot = LocIndexFind(m_locLib.GetActualLocAddress());
+
+        if ((Slot == LOC_INDEX_NONE) || (NumberOfLocs <= 1))
+        {
+            m_LocPrefetchCount = LOC_PREFETCH_DEPTH + 1;
+        }
+        else
+        {
+            if (m_LocPrefetchCount < LOC_PREFETCH_DEPTH)
+            {
+                Offset = m_LocPrefetchDirection * (m_LocPrefetchCount + 1);
+            }
+            else
+            {
+                Offset = -m_LocPrefetchDirection;
+            }
+
+            m_LocPrefetchCount++;
+
+            /* Offset is at most LOC_PREFETCH_DEPTH, wrap around like GetNextLoc. */
+            Offset  = Offset % static_cast<int16_t>(NumberOfLocs);
+            Slot    = static_cast<uint16_t>((Slot + NumberOfLocs + Offset) % NumberOfLocs);
+            Address = m_locLib.LocGetAllDataByIndex(Slot)->Addres;
+
+            if ((LocCacheAge(Address) >= LOC_PREFETCH_FRESH_TIME)
+                && (m_LocSubscriptions < (LOC_SUBSCRIPTIONS_MAX - 1)))
+            {
+                RequestTransmit(requestPrefetch, Address);
+                m_LocPrefetchTime        = millis();
+                m_LocPrefetchResubscribe = true;
+                m_LocPrefetchRequests++;
+            }
+        }
+    }
+    else if ((m_LocPrefetchCount > LOC_PREFETCH_DEPTH) && (m_LocPrefetchResubscribe == true)
+        && ((millis() - m_LocPrefetchTime) >= LOC_PREFETCH_INTERVAL))
+    {
+        m_LocPrefetchResubscribe = false;
+        RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress());
+    }
+}
+
+/***********************************************************************************************************************
+ * Start filling the loc cache, only done once after start up.
+ */
+void wmcApp::LocWarmUpStart(void)
+{
+#if APP_CFG_LOC_CACHE_WARM_UP == 1
+    if (m_LocWarmUpDone == false)
+    {
+        m_LocWarmUpDone   = true;
+        m_LocWarmUpActive = true;
+        m_LocWarmUpCount  = 0;
+        m_LocWarmUpTotal  = m_locLib.GetNumberOfLocs() - 1;
+        if (m_LocWarmUpTotal > (LOC_CACHE_SIZE - 1))
+        {
+            m_LocWarmUpTotal = LOC_CACHE_SIZE - 1;
+        }
+    }
+#endif
+}
+
+/***********************************************************************************************************************
+ * Request the loc info of the next loc around the selected loc (+1, -1, +2, -2, ...). The cache holds LOC_CACHE_SIZE
+ * locs, so at most the LOC_CACHE_SIZE - 1 nearest locs are requested. Nothing is requested within
+ * LOC_WARM_UP_SELECT_PAUSE after a loc selection, while neighbours are prefetched, old cached loc info is shown or
+ * speed is changed. The active loc is requested again before its Z21 subscription would be removed and when the
+ * warm up ends. Returns true when the last loc is requested, the status row shows the progress until then.
+ */
+bool wmcApp::LocWarmUp(void)
+{
+    bool Finished = false;
+    char StatusStr[20];
+    uint16_t NumberOfLocs = m_locLib.GetNumberOfLocs();
+    uint16_t Slot;
+    uint16_t Address;
+    int16_t Offset;
+
+    if ((m_LocWarmUpActive == true) && ((millis() - m_LocWarmUpTime) >= APP_CFG_LOC_CACHE_WARM_UP_INTERVAL)
+        && ((millis() - m_LocPrefetchStartTime) >= LOC_WARM_UP_SELECT_PAUSE)
+        && (m_LocPrefetchCount > LOC_PREFETCH_DEPTH) && (m_LocPrefetchResubscribe == false)
+        && (m_LocCacheProvisional == false) && (m_WmcLocSpeedTxPending == false)
+        && (m_WmcLocSpeedReplyPending == false))
+    {
+        m_LocWarmUpTime = millis();
+        Slot            = LocIndexFind(m_locLib.GetActualLocAddress());
+
+        if (m_LocSubscriptions >= (LOC_SUBSCRIPTIONS_MAX - 1))
+        {
+            RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress());
+        }
+        else if ((Slot != LOC_INDEX_NONE) && (m_LocWarmUpCount < m_LocWarmUpTotal))
+        {
+            Offset = (m_LocWarmUpCount / 2) + 1;
+            if ((m_LocWarmUpCount % 2) != 0)
+            {
+                Offset = -Offset;
+            }
+
+            Offset  = Offset % static_cast<int16_t>(NumberOfLocs);
+            Slot    = static_cast<uint16_t>((Slot + NumberOfLocs + Offset) % NumberOfLocs);
+            Address = m_locLib.LocGetAllDataByIndex(Slot)->Addres;
+            m_LocWarmUpCount++;
+
+            if (LocCacheAge(Address) >= LOC_PREFETCH_FRESH_TIME)
+            {
+                RequestTransmit(requestPrefetch, Address);
+            }
+
+            snprintf(StatusStr, sizeof(StatusStr), "LOC CACHE %hu/%hu", m_LocWarmUpCount, m_LocWarmUpTotal);
+            m_wmcTft.UpdateStatus(StatusStr, false, WmcTft::color_white);
+        }
+
+        if ((Slot == LOC_INDEX_NONE) || (m_LocWarmUpCount >= m_LocWarmUpTotal))
+        {
+            if (m_LocSubscriptions != 0)
+            {
+                RequestTransmit(requestLocInfo, m_locLib.GetActualLocAddress());
+            }
+
+            m_LocWarmUpActive = false;
+            Finished          = true;
+        }
+    }
+
+    return (Finished);
 }
 
 /***********************************************************************************************************************
- * Convert loc data to tft loc data.
+ * Get the age in msec of the cached loc info of a loc, 0xFFFFFFFF when the loc is not cached.
  */
-void wmcApp::convertLocDataToDisplayData(Z21Slave::locInfo* Z21DataPtr, WmcTft::locoInfo* TftDataPtr)
+uint32_t wmcApp::LocCacheAge(uint16_t Address)
 {
-    TftDataPtr->Address = Z21DataPtr->Address;
-    TftDataPtr->Speed   = Z21DataPtr->Speed;
-
-    switch (Z21DataPtr->Steps)
-    {
-    case Z21Slave::locDecoderSpeedSteps14: TftDataPtr->Steps = WmcTft::locoDecoderSpeedSteps14; break;
-    case Z21Slave::locDecoderSpeedSteps28: TftDataPtr->Steps = WmcTft::locoDecoderSpeedSteps28; break;
-    case Z21Slave::locDecoderSpeedSteps128: TftDataPtr->Steps = WmcTft::locoDecoderSpeedSteps128; break;
-    case Z21Slave::locDecoderSpeedStepsUnknown: TftDataPtr->Steps = WmcTft::locoDecoderSpeedStepsUnknown; break;
-    }
-
-    switch (Z21DataPtr->Direction)
-    {
-    case Z21Slave::locDirectionForward: TftDataPtr->Direction = WmcTft::locoDirectionForward; break;
-    case Z21Slave::locDirectionBackward: TftDataPtr->Direction = WmcTft::locoDirectionBackward; break;
-    }
+    uint32_t Age = 0xFFFFFFFF;
+    uint8_t Index;
 
-    switch (Z21DataPtr->Light)
+    for (Index = 0; Index < LOC_CACHE_SIZE; Index++)
     {
-    case Z21Slave::locLightOn: TftDataPtr->Light = WmcTft::locoLightOn; break;
-    case Z21Slave::locLightOff: TftDataPtr->Light = WmcTft::locoLightOff; break;
+        if ((m_LocCache[Index].Info.Address == Address) && (Address != 0))
+        {
+            Age = millis() - m_LocCache[Index].RxTime;
+            break;
+        }
     }
 
-    TftDataPtr->Functions = Z21DataPtr->Functions;
-    TftDataPtr->Occupied  = Z21DataPtr->Occupied;
+    return (Age);
 }
 
 /***********************************************************************************************************************
- * Update loc info on screen.
+ * Update screen, speed and direction with the received loc info when it's the data of the actual loc. While waiting
+ * for the loc info of the last transmitted drive command, loc info with another speed or direction is the echo of an
+ * earlier drive command and ignored until LOC_SPEED_REPLY_TIMEOUT is elapsed.
  */
-bool wmcApp::updateLocInfoOnScreen(bool updateAll)
+bool wmcApp::updateLocInfo(bool updateAll)
 {
-    uint8_t Index        = 0;
-    bool Result          = true;
-    m_WmcLocInfoReceived = m_z21Slave.LanXLocoInfo();
-    WmcTft::locoInfo locInfoActual;
-    WmcTft::locoInfo locInfoPrevious;
+    bool Result = updateLocInfoOnScreen(updateAll);
+    bool Adopt  = (m_WmcLocSpeedTxPending == false); /* When a newer speed is not transmitted yet keep it. */
 
-    if (m_locLib.GetActualLocAddress() == m_WmcLocInfoReceived->Address)
+    if ((Result == true) && (m_WmcLocSpeedReplyPending == true)
+        && (m_WmcLocInfoReceived->Address == m_WmcLocSpeedTxAddress))
     {
-        switch (m_WmcLocInfoReceived->Steps)
+        if ((m_WmcLocInfoReceived->Speed == m_WmcLocSpeedTxSpeed)
+            && (m_WmcLocInfoReceived->Direction == m_WmcLocSpeedTxDirection))
         {
-        case Z21Slave::locDecoderSpeedSteps14: m_locLib.DecoderStepsUpdate(decoderStep14); break;
-        case Z21Slave::locDecoderSpeedSteps28: m_locLib.DecoderStepsUpdate(decoderStep28); break;
-        case Z21Slave::locDecoderSpeedSteps128: m_locLib.DecoderStepsUpdate(decoderStep128); break;
-        case Z21Slave::locDecoderSpeedStepsUnknown: m_locLib.DecoderStepsUpdate(decoderStep28); break;
+            m_WmcLocSpeedReplyPending = false;
         }
-
-        for (Index = 0; Index < 5; Index++)
+        else if ((millis() - m_WmcLocSpeedTxTime) < LOC_SPEED_REPLY_TIMEOUT)
         {
-            m_locFunctionAssignment[Index] = m_locLib.FunctionAssignedGet(Index);
+            Adopt = false;
         }
+    }
 
-        /* Invert functions so function symbols are updated if new loc is selected
-         * and set new direction. */
-        if (m_locSelection == true)
+    if ((Result == true) && (Adopt == true))
+    {
+        m_locLib.SpeedUpdate(m_WmcLocInfoReceived->Speed);
+
+        if (m_WmcLocInfoReceived->Direction == Z21Slave::locDirectionForward)
         {
-            m_WmcLocInfoControl.Functions = ~m_WmcLocInfoReceived->Functions;
+            m_locLib.DirectionSet(directionForward);
+        }
+        else
+        {
+            m_locLib.DirectionSet(directionBackWard);
         }
-
-        convertLocDataToDisplayData(m_WmcLocInfoReceived, &locInfoActual);
-        convertLocDataToDisplayData(&m_WmcLocInfoControl, &locInfoPrevious);
-        m_wmcTft.UpdateLocInfo(&locInfoActual, &locInfoPrevious, m_locFunctionAssignment, m_locLib.GetLocName(),
-            updateAll | m_locSelection);
-
-        memcpy(&m_WmcLocInfoControl, m_WmcLocInfoReceived, sizeof(Z21Slave::locInfo));
-        m_locSelection = false;
-    }
-    else
-    {
-        Result = false;
     }
 
     return (Result);
@@ -2376,6 +3471,224 @@ void wmcApp::PrepareLanXSetLocoDriveAndTransmit(uint16_t Speed)
 
     m_z21Slave.LanXSetLocoDrive(&LocInfoTx);
     WmcCheckForDataTx();
+
+    /* Latest speed transmitted, wait for loc info. */
+    m_WmcLocSpeedTxPending    = false;
+    m_WmcLocSpeedReplyPending = true;
+    m_WmcLocSpeedTxTime       = millis();
+    m_WmcLocSpeedTxAddress    = LocInfoTx.Address;
+    m_WmcLocSpeedTxSpeed      = LocInfoTx.Speed;
+    m_WmcLocSpeedTxDirection  = LocInfoTx.Direction;
+}
+
+/***********************************************************************************************************************
+ * Get the position of a loc in the loc library using the address index. The index is build again when the loc
+ * library was changed. Returns LOC_INDEX_NONE when the loc is not present.
+ */
+uint16_t wmcApp::LocIndexFind(uint16_t Address)
+{
+    uint16_t Slot = LOC_INDEX_NONE;
+    uint16_t Hash = LocIndexHash(Address);
+    uint16_t Probe;
+
+    if (m_LocIndexValid == false)
+    {
+        LocIndexBuild();
+    }
+
+    for (Probe = 0; Probe < LOC_INDEX_SIZE; Probe++)
+    {
+        if (m_LocIndex[Hash].Address == Address)
+        {
+            Slot = m_LocIndex[Hash].Slot;
+            break;
+        }
+        else if (m_LocIndex[Hash].Address == 0)
+        {
+            break;
+        }
+
+        Hash = (Hash + 1) & (LOC_INDEX_SIZE - 1);
+    }
+
+    return (Slot);
+}
+
+/***********************************************************************************************************************
+ * Add a loc to the address index. The index has room for twice the number of locs the loc library can hold, so a free
+ * entry is always found.
+ */
+void wmcApp::LocIndexAdd(uint16_t Address, uint16_t Slot)
+{
+    uint16_t Hash = LocIndexHash(Address);
+    uint16_t Probe;
+
+    for (Probe = 0; Probe < LOC_INDEX_SIZE; Probe++)
+    {
+        if ((m_LocIndex[Hash].Address == 0) || (m_LocIndex[Hash].Address == Address))
+        {
+            m_LocIndex[Hash].Address = Address;
+            m_LocIndex[Hash].Slot    = Slot;
+            break;
+        }
+
+        Hash = (Hash + 1) & (LOC_INDEX_SIZE - 1);
+    }
+}
+
+/***********************************************************************************************************************
+ * Build the address index of all locs in the loc library.
+ */
+void wmcApp::LocIndexBuild(void)
+{
+    uint16_t Slot;
+    uint16_t NumberOfLocs = m_locLib.GetNumberOfLocs();
+
+    memset(m_LocIndex, 0, sizeof(m_LocIndex));
+    m_LocIndexValid = true;
+
+    for (Slot = 0; Slot < NumberOfLocs; Slot++)
+    {
+        LocIndexAdd(m_locLib.LocGetAllDataByIndex(Slot)->Addres, Slot);
+    }
+}
+
+/***********************************************************************************************************************
+ * Multiplicative hash of a loc address, returns the first position in the address index.
+ */
+uint16_t wmcApp::LocIndexHash(uint16_t Address)
+{
+    return (static_cast<uint16_t>(Address * 40503U) >> (16 - LOC_INDEX_BITS));
+}
+
+/***********************************************************************************************************************
+ * Check whether a loc added at the end of the sorted loc library breaks the address order. The loc library is kept
+ * sorted, so only the last loc has to be compared and sorting is skipped when locs are added in increasing order.
+ */
+bool wmcApp::LocSortRequired(uint16_t Address)
+{
+    bool Result           = false;
+    uint16_t NumberOfLocs = m_locLib.GetNumberOfLocs();
+
+    if (NumberOfLocs > 0)
+    {
+        Result = (m_locLib.LocGetAllDataByIndex(NumberOfLocs - 1)->Addres > Address);
+    }
+
+    return (Result);
+}
+
+/***********************************************************************************************************************
+ * Add a received loc of the loc database to the receive buffer. Returns true when all locs are received.
+ */
+bool wmcApp::LocLibRxAdd(Z21Slave::locLibData* DataPtr)
+{
+    uint8_t Index = DataPtr->Actual;
+
+    /* New transmission or the transmitting handheld changed its database, start again. */
+    if ((m_LocLibRxActive == false) || (DataPtr->Total != m_LocLibRxTotal))
+    {
+        memset(m_LocLibRxBitmap, 0, sizeof(m_LocLibRxBitmap));
+        m_LocLibRxActive = true;
+        m_LocLibRxTotal  = DataPtr->Total;
+        m_LocLibRxCount  = 0;
+    }
+
+    m_LocLibRxTime = millis();
+
+    /* The database is transmitted several times, only store locs not received before. */
+    if ((Index < m_LocLibRxTotal) && ((m_LocLibRxBitmap[Index / 8] & (1 << (Index % 8))) == 0))
+    {
+        m_LocLibRx[Index].Address = DataPtr->Address;
+        strncpy(m_LocLibRx[Index].Name, DataPtr->NameStr, sizeof(m_LocLibRx[Index].Name) - 1);
+        m_LocLibRx[Index].Name[sizeof(m_LocLibRx[Index].Name) - 1] = '\0';
+
+        m_LocLibRxBitmap[Index / 8] |= static_cast<uint8_t>(1 << (Index % 8));
+        m_LocLibRxCount++;
+    }
+
+    return (m_LocLibRxCount >= m_LocLibRxTotal);
+}
+
+/***********************************************************************************************************************
+ * Store the received locs not present yet, sort the locs once and show the number of missing locs in the status row.
+ * Received locs not stored because the loc library is full are counted as missing.
+ */
+void wmcApp::LocLibRxCommit(void)
+{
+    uint8_t Index;
+    char StatusStr[20];
+    bool SortRequired                = false;
+    uint8_t locFunctionAssignment[5] = { 0, 1, 2, 3, 4 };
+    uint16_t NumberOfLocs;
+    bool LocSorted;
+    uint16_t Missing = m_LocLibRxTotal - m_LocLibRxCount;
+
+    m_LocLibRxActive = false;
+
+    for (Index = 0; Index < m_LocLibRxTotal; Index++)
+    {
+        if (((m_LocLibRxBitmap[Index / 8] & (1 << (Index % 8))) != 0)
+            && (LocIndexFind(m_LocLibRx[Index].Address) == LOC_INDEX_NONE))
+        {
+            NumberOfLocs = m_locLib.GetNumberOfLocs();
+            LocSorted    = (LocSortRequired(m_LocLibRx[Index].Address) == false);
+            m_locLib.StoreLoc(m_LocLibRx[Index].Address, locFunctionAssignment, m_LocLibRx[Index].Name,
+                LocLib::storeAddNoAutoSelect);
+
+            /* Only index the loc when it's added, LocLib does not store locs when it's full. */
+            if (m_locLib.GetNumberOfLocs() > NumberOfLocs)
+            {
+                LocIndexAdd(m_LocLibRx[Index].Address, m_locLib.GetNumberOfLocs() - 1);
+                SortRequired |= (LocSorted == false);
+            }
+            else
+            {
+                Missing++;
+            }
+        }
+    }
+
+    if (SortRequired == true)
+    {
+        m_wmcTft.UpdateStatus("SORTING  ", false, WmcTft::color_white);
+        m_locLib.LocBubbleSort();
+        m_LocIndexValid = false;
+    }
+
+    m_wmcTft.UpdateSelectedAndNumberOfLocs(m_locLib.GetActualSelectedLocIndex(), m_locLib.GetNumberOfLocs());
+
+    if (Missing != 0)
+    {
+        snprintf(StatusStr, sizeof(StatusStr), "LOCS MISSING %hu", Missing);
+        m_wmcTft.UpdateStatus(StatusStr, false, WmcTft::color_magenta);
+    }
+    else
+    {
+        m_wmcTft.UpdateStatus("POWER OFF", false, WmcTft::color_red);
+    }
+}
+
+/***********************************************************************************************************************
+ * Transmit the latest requested speed when the minimum time since the previous drive command has elapsed.
+ */
+void wmcApp::LocSpeedTransmit(void)
+{
+    if ((m_WmcLocSpeedTxPending == true) && ((millis() - m_WmcLocSpeedTxTime) >= LOC_SPEED_TX_INTERVAL))
+    {
+        PrepareLanXSetLocoDriveAndTransmit(m_WmcLocSpeedTarget);
+    }
+}
+
+/***********************************************************************************************************************
+ * Transmit the latest requested speed immediately, used before another loc or state is selected.
+ */
+void wmcApp::LocSpeedFlush(void)
+{
+    if (m_WmcLocSpeedTxPending == true)
+    {
+        PrepareLanXSetLocoDriveAndTransmit(m_WmcLocSpeedTarget);
+    }
 }
 
 /***********************************************************************************************************************
@@ -2395,3 +3708,230 @@ int8_t wmcApp::CheckPulseSwitchRevert(int8_t Delta)
 
     return (DeltaResult);
 }
+
+#if APP_CFG_EVENT_TIMING == 1
+/***********************************************************************************************************************
+ * States and names used for the event timing report. Index in this table is the index in m_EventTiming.
+ */
+static const struct
+{
+    wmcApp* StatePtr;
+    const char* Name;
+} EventTimingStates[] = {
+    { &wmcApp::state<stateInit>(), "Init" },
+    { &wmcApp::state<stateSetUpWifi>(), "SetUpWifi" },
+    { &wmcApp::state<stateInitUdpConnect>(), "InitUdpConnect" },
+    { &wmcApp::state<stateInitUdpConnectFail>(), "InitUdpConnectFail" },
+    { &wmcApp::state<stateAdcButtons>(), "AdcButtons" },
+    { &wmcApp::state<stateSetUpWifiFail>(), "SetUpWifiFail" },
+    { &wmcApp::state<stateInitBroadcast>(), "InitBroadcast" },
+    { &wmcApp::state<stateInitStatusGet>(), "InitStatusGet" },
+    { &wmcApp::state<stateInitLocInfoGet>(), "InitLocInfoGet" },
+    { &wmcApp::state<statePowerOff>(), "PowerOff" },
+    { &wmcApp::state<statePowerOn>(), "PowerOn" },
+    { &wmcApp::state<stateEmergencyStop>(), "EmergencyStop" },
+    { &wmcApp::state<statePowerProgrammingMode>(), "PowerProgrammingMode" },
+    { &wmcApp::state<stateTurnoutControl>(), "TurnoutControl" },
+    { &wmcApp::state<stateTurnoutControlPowerOff>(), "TurnoutControlPowerOff" },
+    { &wmcApp::state<stateMainMenu1>(), "MainMenu1" },
+    { &wmcApp::state<stateMainMenu2>(), "MainMenu2" },
+    { &wmcApp::state<stateMenuTransmitLocDatabase>(), "MenuTransmitLocDatabase" },
+    { &wmcApp::state<stateMenuLocAdd>(), "MenuLocAdd" },
+    { &wmcApp::state<stateMenuLocFunctionsAdd>(), "MenuLocFunctionsAdd" },
+    { &wmcApp::state<stateMenuLocFunctionsChange>(), "MenuLocFunctionsChange" },
+    { &wmcApp::state<stateMenuLocDelete>(), "MenuLocDelete" },
+    { &wmcApp::state<stateCommandLineInterfaceActive>(), "CommandLineInterfaceActive" },
+    { &wmcApp::state<stateCvProgramming>(), "CvProgramming" },
+};
+
+/***********************************************************************************************************************
+ * Get the handling time of all events so far, used to subtract the time of nested events from the outer event.
+ */
+uint32_t wmcApp::EventTimingNested(void)
+{
+    return (m_EventTimingNested);
+}
+
+/***********************************************************************************************************************
+ * Add the time needed by a state to handle an event, print the results periodically. Events sent during the handling
+ * of this event are counted for their own state only, so only the exclusive time of this event is added.
+ */
+void wmcApp::EventTimingUpdate(wmcApp* StatePtr, uint32_t Duration, uint32_t NestedStart)
+{
+    uint8_t Index      = 0;
+    uint32_t Exclusive = Duration - (m_EventTimingNested - NestedStart);
+
+    /* For an outer event the complete handling time of this event is nested time. */
+    m_EventTimingNested = NestedStart + Duration;
+
+    while ((Index < EVENT_TIMING_STATES) && (EventTimingStates[Index].StatePtr != StatePtr))
+    {
+        Index++;
+    }
+
+    if (Index < EVENT_TIMING_STATES)
+    {
+        m_EventTiming[Index].Count++;
+        m_EventTiming[Index].Total += Exclusive;
+        if (Exclusive > m_EventTiming[Index].Max)
+        {
+            m_EventTiming[Index].Max = Exclusive;
+        }
+    }
+
+    /* Only report outside the measured time of an outer event. */
+    if ((m_EventDispatchDepth <= 1) && ((millis() - m_EventTimingReportTime) >= APP_CFG_EVENT_TIMING_REPORT_TIME))
+    {
+        m_EventTimingReportTime = millis();
+        EventTimingReport();
+    }
+}
+
+/***********************************************************************************************************************
+ * Print the collected event timing per state and restart the measurement.
+ */
+void wmcApp::EventTimingReport(void)
+{
+    static const char* const RequestName[requestTypes] = { "REQ status", "REQ loc info", "REQ prefetch" };
+    uint8_t Index;
+    uint32_t Average;
+
+    Serial.println("EVENT TIMING : state events nsec/event max usec");
+
+    for (Index = 0; Index < EVENT_TIMING_STATES; Index++)
+    {
+        if (m_EventTiming[Index].Count != 0)
+        {
+            Serial.print(EventTimingStates[Index].Name);
+            Serial.print(" ");
+            Serial.print(m_EventTiming[Index].Count);
+            Serial.print(" ");
+
+            Average = static_cast<uint32_t>(
+                (static_cast<uint64_t>(m_EventTiming[Index].Total) * 1000) / m_EventTiming[Index].Count);
+            Serial.print(Average);
+            Serial.print(" ");
+            Serial.println(m_EventTiming[Index].Max);
+        }
+    }
+
+    if (m_RxFrames != 0)
+    {
+        Serial.print("RX frames ");
+        Serial.print(m_RxFrames);
+        Serial.print(" cycles/frame ");
+        Serial.print(m_RxFrameCycles / m_RxFrames);
+        Serial.print(" bytes copied ");
+        Serial.println(m_RxBytesCopied);
+    }
+
+    WmcRxStatisticsPrint();
+
+    if (m_TxPackets != 0)
+    {
+        Serial.print("TX frames ");
+        Serial.print(m_TxFrames);
+        Serial.print(" packets ");
+        Serial.print(m_TxPackets);
+        Serial.print(" max frames/packet ");
+        Serial.println(m_TxFramesPacketMax);
+    }
+
+    for (Index = 0; Index < requestTypes; Index++)
+    {
+        if ((m_Requests[Index].Responses != 0) || (m_Requests[Index].PollsAvoided != 0))
+        {
+            Average = 0;
+            if (m_Requests[Index].Responses != 0)
+            {
+                Average = m_Requests[Index].RoundTripTotal / m_Requests[Index].Responses;
+            }
+
+            Serial.print(RequestName[Index]);
+            Serial.print(" responses ");
+            Serial.print(m_Requests[Index].Responses);
+            Serial.print(" rtt msec ");
+            Serial.print(Average);
+            Serial.print(" max ");
+            Serial.print(m_Requests[Index].RoundTripMax);
+            Serial.print(" timeouts ");
+            Serial.print(m_Requests[Index].Timeouts);
+            Serial.print(" suppressed ");
+            Serial.print(m_Requests[Index].Suppressed);
+            Serial.print(" polls avoided ");
+            Serial.println(m_Requests[Index].PollsAvoided);
+        }
+
+        m_Requests[Index].Responses      = 0;
+        m_Requests[Index].RoundTripTotal = 0;
+        m_Requests[Index].RoundTripMax   = 0;
+    }
+
+    if ((m_LocCacheHits + m_LocCacheMisses) != 0)
+    {
+        Serial.print("LOC CACHE hits ");
+        Serial.print(m_LocCacheHits);
+        Serial.print(" misses ");
+        Serial.print(m_LocCacheMisses);
+        Serial.print(" age msec ");
+        Serial.print((m_LocCacheHits != 0) ? (m_LocCacheAgeTotal / m_LocCacheHits) : 0);
+        Serial.print(" max ");
+        Serial.print(m_LocCacheAgeMax);
+        Serial.print(" prefetched ");
+        Serial.println(m_LocPrefetchRequests);
+    }
+
+    if (m_JournalWrites != 0)
+    {
+        Serial.print("JOURNAL writes ");
+        Serial.print(m_JournalWrites);
+        Serial.print(" compactions ");
+        Serial.println(m_JournalCompactions);
+    }
+
+    memset(m_EventTiming, 0, sizeof(m_EventTiming));
+    m_RxFrames      = 0;
+    m_RxFrameCycles = 0;
+}
+#endif
+
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+/***********************************************************************************************************************
+ * Store a latency sample, when enough samples are collected print p50 and p99 and restart the measurement.
+ */
+void wmcApp::LatencyAdd(latencyMeasurement* MeasurementPtr, uint32_t Latency)
+{
+    uint32_t Sorted[LATENCY_SAMPLES];
+    uint32_t Value;
+    uint8_t Index;
+    uint8_t IndexSort;
+
+    MeasurementPtr->Samples[MeasurementPtr->Count] = Latency;
+    MeasurementPtr->Count++;
+
+    if (MeasurementPtr->Count >= LATENCY_SAMPLES)
+    {
+        /* Insertion sort, only executed once per LATENCY_SAMPLES samples. */
+        for (Index = 0; Index < LATENCY_SAMPLES; Index++)
+        {
+            Value     = MeasurementPtr->Samples[Index];
+            IndexSort = Index;
+            while ((IndexSort > 0) && (Sorted[IndexSort - 1] > Value))
+            {
+                Sorted[IndexSort] = Sorted[IndexSort - 1];
+                IndexSort--;
+            }
+            Sorted[IndexSort] = Value;
+        }
+
+        Serial.print(MeasurementPtr->Name);
+        Serial.print(" p50 : ");
+        Serial.print(Sorted[(LATENCY_SAMPLES * 50) / 100]);
+        Serial.print(" usec p99 : ");
+        Serial.print(Sorted[(LATENCY_SAMPLES * 99) / 100]);
+        Serial.println(" usec");
+
+        MeasurementPtr->Count = 0;
+    }
+}
+#endif
@@ -12,6 +12,7 @@
  **********************************************************************************************************************/
 #include "LocStorage.h"
 #include "Loclib.h"
+#include "app_cfg.h"
 #include "WmcCli.h"
 #include "WmcTft.h"
 #include "Z21Slave.h"
@@ -43,6 +44,11 @@ public:
     virtual void react(updateEvent50msec const&);
     virtual void react(updateEvent100msec const&);
     virtual void react(updateEvent500msec const&);
+    virtual void react(z21TrackPowerEvent const&);
+    virtual void react(z21LocInfoEvent const&);
+    virtual void react(z21LocLibDataEvent const&);
+    virtual void react(z21CvNackEvent const&);
+    virtual void react(z21CvResultEvent const&);
 
     virtual void entry(void){}; /* entry actions in some states */
     virtual void exit(void){};  /* no exit actions at all */
@@ -54,12 +60,48 @@ public:
         emergency
     };
 
+    static void EventDispatchBegin(void);
+    static void EventDispatchEnd(void);
+
+#if APP_CFG_EVENT_TIMING == 1
+    static uint32_t EventTimingNested(void);
+    static void EventTimingUpdate(wmcApp* StatePtr, uint32_t Duration, uint32_t NestedStart);
+#endif
+
 protected:
-    Z21Slave::dataType WmcCheckForDataRx(void);
-    void WmcCheckForDataTx(void);
+    static bool WmcRxPacketRead(void);
+    static bool WmcRxFrameRead(uint8_t* DataPtr, uint16_t Length);
+    static bool WmcRxFrameSkip(uint8_t* BufferPtr, uint16_t BufferSize, uint16_t Length);
+    static bool WmcRxLocInfoFilter(uint8_t* FramePtr, uint16_t FrameLength);
+    static bool WmcRxLocInfoWatched(uint16_t Address);
+    static void WmcRxReceive(void);
+    static void WmcRxFrameDecode(uint16_t Length);
+    static void WmcRxStatisticsPrint(void);
+    static void WmcRxEventSend(Z21Slave::dataType Data);
+    static void WmcCheckForDataTx(void);
+    static void WmcTxFlush(void);
     void convertLocDataToDisplayData(Z21Slave::locInfo* Z21DataPtr, WmcTft::locoInfo* TftDataPtr);
     bool updateLocInfoOnScreen(bool updateAll);
+    bool updateLocInfo(bool updateAll);
     void PrepareLanXSetLocoDriveAndTransmit(uint16_t Speed);
+    void LocSpeedTransmit(void);
+    void LocSpeedFlush(void);
+    static uint16_t LocIndexFind(uint16_t Address);
+    static void LocIndexAdd(uint16_t Address, uint16_t Slot);
+    static void LocIndexBuild(void);
+    static uint16_t LocIndexHash(uint16_t Address);
+    bool LocSortRequired(uint16_t Address);
+    static void LocCacheUpdate(Z21Slave::locInfo* InfoPtr);
+    static Z21Slave::locInfo* LocCacheGet(uint16_t Address);
+    void LocCacheShow(void);
+    static bool LocCacheProvisionalEnd(void);
+    static uint32_t LocCacheAge(uint16_t Address);
+    static void LocPrefetchStart(int8_t Delta);
+    static void LocPrefetch(void);
+    static void LocWarmUpStart(void);
+    bool LocWarmUp(void);
+    bool LocLibRxAdd(Z21Slave::locLibData* DataPtr);
+    void LocLibRxCommit(void);
     int8_t CheckPulseSwitchRevert(int8_t Delta);
 
     static const uint8_t CONNECT_CNT_MAX_FAIL_CONNECT_WIFI = 200;
@@ -70,6 +112,28 @@ protected:
     static const uint8_t FUNCTION_MAX                      = 28;
     static const uint8_t ADC_VALUES_ARRAY_SIZE             = 7;
     static const uint8_t ADC_VALUES_ARRAY_REFERENCE_INDEX  = 6;
+    static const uint8_t RX_PACKETS_PER_TICK_MAX           = 16;
+    static const uint8_t RX_FRAME_BUFFER_SIZE              = 64;
+    static const uint16_t TX_PACKET_BUFFER_SIZE            = 256;
+    static const uint8_t Z21_FRAME_LENGTH_MIN              = 4; /* Length bytes and header bytes. */
+    static const uint8_t Z21_LOCO_INFO_LENGTH_MIN          = 7; /* Up to and including address bytes. */
+    static const uint8_t Z21_HEADER_LAN_X                  = 0x40;
+    static const uint8_t Z21_X_HEADER_LOCO_INFO            = 0xEF;
+    static const uint8_t Z21_X_HEADER_LOCO_DRIVE           = 0xE4;
+    static const uint8_t Z21_LOCO_DRIVE_DB0                = 0x10; /* Upper nibble of DB0 of LAN_X_SET_LOCO_DRIVE. */
+    static const uint16_t LOC_LIB_LOCS_MAX                 = 255; /* LocLib uses 8 bit loc indexes and counts. */
+    static const uint16_t LOC_LIB_RX_ENTRIES_MAX           = LOC_LIB_LOCS_MAX;
+    static const uint8_t LOC_LIB_RX_NAME_SIZE              = 11;
+    static const uint32_t LOC_LIB_RX_TIMEOUT               = 2000; /* No loc received, store the received locs. */
+    static const uint8_t LOC_INDEX_BITS                    = 9;
+    static const uint16_t LOC_INDEX_SIZE                   = 1 << LOC_INDEX_BITS; /* At least twice LOC_LIB_LOCS_MAX. */
+    static const uint16_t LOC_INDEX_NONE                   = 0xFFFF;
+    static const uint8_t LOC_CACHE_SIZE                    = 16;
+    static const uint8_t LOC_PREFETCH_DEPTH                = 3;     /* Locs requested in scroll direction. */
+    static const uint32_t LOC_PREFETCH_INTERVAL            = 50;    /* Minimum time in msec between requests. */
+    static const uint32_t LOC_PREFETCH_FRESH_TIME          = 5000;  /* Cached loc info not requested again. */
+    static const uint32_t LOC_CACHE_MAX_AGE                = 10000; /* Older cached loc info is only shown. */
+    static const uint32_t LOC_WARM_UP_SELECT_PAUSE         = 1000;  /* No warm up requests after a loc selection. */
 
     static WmcTft m_wmcTft;
     static LocLib m_locLib;
@@ -92,13 +156,18 @@ protected:
     static uint16_t m_locAddressChange;
     static uint16_t m_locAddressChangeActive;
     static uint16_t m_locDbDataTransmitCnt;
-    static uint32_t m_locDbDataTransmitCntRepeat;
+    static uint8_t m_locDbDataTransmitPass;  /* Number of completely transmitted passes of the loc database. */
+    static uint32_t m_locDbDataTransmitTime; /* Time in msec of the last transmitted loc database packet. */
+    static bool m_LocLibRxActive;            /* Reception of loc database in progress. */
+    static uint8_t m_LocLibRxTotal;          /* Number of locs in the received loc database. */
+    static uint8_t m_LocLibRxCount;          /* Number of different received locs. */
+    static uint32_t m_LocLibRxTime;          /* Time in msec of the last received loc. */
     static uint16_t m_locAddressDelete;
     static uint16_t m_LocAddresActualDelete;
-    static byte m_WmcPacketBuffer[40];
+    static int m_WmcPacketRemaining;
     static uint8_t m_locFunctionAdd;
     static uint8_t m_locFunctionChange;
-    static uint16_t m_LocInfoRequestCounter;
+    static bool m_LocInfoRequestFailed;
     static uint8_t m_locFunctionAssignment[5];
     static Z21Slave::locInfo m_WmcLocInfoControl;
     static Z21Slave::locInfo* m_WmcLocInfoReceived;
@@ -107,7 +176,13 @@ protected:
     static bool m_PulseSwitchInvert;
     static bool m_TurnoutAutoOff;
     static uint8_t m_ButtonIndexPrevious;
-    static bool m_WmcLocSpeedRequestPending;
+    static bool m_WmcLocSpeedTxPending;                     /* Requested speed not transmitted yet. */
+    static bool m_WmcLocSpeedReplyPending;                  /* Waiting for loc info after transmitting speed. */
+    static uint16_t m_WmcLocSpeedTarget;                    /* Latest requested speed. */
+    static uint32_t m_WmcLocSpeedTxTime;                    /* Time of last transmitted drive command. */
+    static uint16_t m_WmcLocSpeedTxAddress;                 /* Loc address of last transmitted drive command. */
+    static uint16_t m_WmcLocSpeedTxSpeed;                   /* Speed of last transmitted drive command. */
+    static Z21Slave::locDirection m_WmcLocSpeedTxDirection; /* Direction of last transmitted drive command. */
     static bool m_CvPomProgramming;
     static bool m_CvPomProgrammingFromPowerOn;
     static bool m_EmergencyStopEnabled;
@@ -116,9 +191,208 @@ protected:
     static uint16_t m_AdcButtonValuePrevious;
     static uint8_t m_AdcIndex;
 
+    static uint8_t m_RxPacketsTick;      /* Number of received packets processed in last tick. */
+    static uint8_t m_RxPacketsTickMax;   /* Maximum number of received packets processed in one tick. */
+    static uint32_t m_RxBacklogCnt;      /* Number of ticks with more packets pending than processed. */
+    static uint32_t m_RxFrameErrorCnt;   /* Number of received frames with invalid length. */
+    static uint32_t m_RxFrameSkipCnt;    /* Number of skipped frames longer than RX_FRAME_BUFFER_SIZE. */
+    static uint32_t m_RxBytesCopied;     /* Number of bytes read from the network stack. */
+    static uint32_t m_RxLocInfoFiltered; /* Number of skipped loc info frames of locs not in the loc library. */
+
+    /**
+     * Received loc of the loc database.
+     */
+    struct locLibRxEntry
+    {
+        uint16_t Address;
+        char Name[LOC_LIB_RX_NAME_SIZE];
+    };
+
+    /* Received loc database, the bitmap contains the received loc indexes. */
+    static locLibRxEntry m_LocLibRx[LOC_LIB_RX_ENTRIES_MAX];
+    static uint8_t m_LocLibRxBitmap[(LOC_LIB_RX_ENTRIES_MAX + 7) / 8];
+
+    /**
+     * Entry of the address index, address 0 is an unused entry.
+     */
+    struct locIndexEntry
+    {
+        uint16_t Address; /* Loc address. */
+        uint16_t Slot;    /* Position of the loc in the loc library. */
+    };
+
+    /* Open addressing hash table from loc address to position in the loc library. */
+    static locIndexEntry m_LocIndex[LOC_INDEX_SIZE];
+    static bool m_LocIndexValid; /* Cleared when the loc library is changed. */
+
+    /**
+     * Latest loc info of a loc, address 0 is an unused entry.
+     */
+    struct locCacheEntry
+    {
+        Z21Slave::locInfo Info; /* Latest received loc info. */
+        uint32_t RxTime;        /* Time in msec the loc info was received. */
+    };
+
+    static locCacheEntry m_LocCache[LOC_CACHE_SIZE];
+    static uint32_t m_LocCacheHits;     /* Number of selected locs shown from the cache. */
+    static uint32_t m_LocCacheMisses;   /* Number of selected locs not in the cache. */
+    static uint32_t m_LocCacheAgeTotal; /* Sum of the age in msec of the cached loc info on a hit. */
+    static uint32_t m_LocCacheAgeMax;   /* Maximum age in msec of cached loc info on a hit. */
+    static bool m_LocCacheProvisional;  /* Old cached loc info shown, waiting for loc info of the control unit. */
+
+    static int8_t m_LocPrefetchDirection;   /* Scroll direction, 1 or -1. */
+    static uint8_t m_LocPrefetchCount;      /* Number of handled neighbour locs, prefetch ends after DEPTH + 1. */
+    static uint32_t m_LocPrefetchTime;      /* Time in msec of the last prefetch request. */
+    static uint32_t m_LocPrefetchStartTime; /* Time in msec of the last loc selection. */
+    static uint32_t m_LocPrefetchRequests;  /* Number of transmitted prefetch requests. */
+    static bool m_LocPrefetchResubscribe;   /* Request the active loc again after the prefetch requests. */
+
+    static bool m_LocWarmUpDone;      /* Loc cache filled after start up. */
+    static bool m_LocWarmUpActive;    /* Filling of the loc cache in progress. */
+    static uint16_t m_LocWarmUpCount; /* Number of handled locs. */
+    static uint16_t m_LocWarmUpTotal; /* Number of locs to be handled. */
+    static uint32_t m_LocWarmUpTime;  /* Time in msec of the last handled loc. */
+
+    /**
+     * Frequently changing values stored in the journal.
+     */
+    enum journalKey
+    {
+        journalTurnoutAddress = 0,
+        journalKeys
+    };
+
+    static const uint16_t JOURNAL_SECTOR_SIZE = 4096;
+    static const uint8_t JOURNAL_SECTORS      = 2;      /* Used alternately, a compacted copy goes to the other one. */
+    static const uint16_t JOURNAL_MAGIC       = 0x4A4E; /* Header of a completely written sector. */
+
+    static uint16_t m_JournalValues[journalKeys]; /* Latest value of each key. */
+    static uint8_t m_JournalValid;                /* Bit per key, set when the key has a value. */
+    static bool m_JournalFlash;                   /* Journal sectors reserved in the flash layout. */
+    static uint8_t m_JournalSector;               /* Sector with the latest values. */
+    static uint16_t m_JournalSequence;            /* Sequence number in the header of m_JournalSector. */
+    static uint16_t m_JournalOffset;              /* Offset in the sector of the next record. */
+    static uint32_t m_JournalWrites;              /* Number of written records. */
+    static uint32_t m_JournalCompactions;         /* Number of sector erases. */
+
+    static void JournalInit(void);
+    static uint16_t JournalGet(journalKey Key, uint16_t Default);
+    static void JournalSet(journalKey Key, uint16_t Value);
+#if APP_CFG_JOURNAL == 1
+    static uint32_t JournalAddress(uint8_t Sector);
+    static uint32_t JournalRecord(uint8_t Key, uint16_t Value);
+    static void JournalCompact(void);
+#endif
+
+    static uint8_t m_RxFrame[RX_FRAME_BUFFER_SIZE]; /* Received frame including length bytes. */
+    static uint8_t m_EventDispatchDepth;
+
+    /* Frames to be transmitted in one packet. */
+    static uint8_t m_TxBuffer[TX_PACKET_BUFFER_SIZE];
+    static uint16_t m_TxBufferLength;
+    static uint8_t m_TxBufferFrames;
+    static uint8_t m_TxFramesPacketMax; /* Maximum number of frames in one packet. */
+    static uint32_t m_TxFrames;         /* Number of transmitted frames. */
+    static uint32_t m_TxPackets;        /* Number of transmitted packets. */
+    static uint32_t m_TxTime;           /* Time in msec of the last transmitted packet. */
+
+    /**
+     * Requests waiting for a response of the control.
+     */
+    enum requestType
+    {
+        requestStatus = 0,
+        requestLocInfo,
+        requestPrefetch,
+        requestTypes
+    };
+
+    /**
+     * Administration of a request.
+     */
+    struct request
+    {
+        bool Pending;            /* Transmitted, no response received yet. */
+        uint16_t Address;        /* Loc address of a loc info request. */
+        uint32_t TxTime;         /* Time in msec of the last transmission. */
+        uint8_t Retries;         /* Number of retransmissions of the pending request. */
+        uint32_t Responses;      /* Number of received responses. */
+        uint32_t RoundTripTotal; /* Sum of round trip times in msec. */
+        uint32_t RoundTripMax;   /* Longest round trip time in msec. */
+        uint32_t Timeouts;       /* Number of elapsed timeouts. */
+        uint32_t Suppressed;     /* Number of requests not transmitted because the same request is pending. */
+        uint16_t RxAddress;      /* Loc address of which the data is refreshed. */
+        uint32_t RxTime;         /* Time in msec of the last received response or broadcast of RxAddress. */
+        uint32_t PollsAvoided;   /* Number of requests not transmitted because of a recent broadcast. */
+    };
+
+    static const uint16_t REQUEST_TIMEOUT_STATUS   = 300;
+    static const uint16_t REQUEST_TIMEOUT_LOC_INFO = 400;
+    static const uint16_t REQUEST_TIMEOUT_PREFETCH = 400;
+    static const uint8_t REQUEST_RETRIES_MAX       = 10;
+    static const uint32_t TX_KEEP_ALIVE_TIME       = 30000; /* The Z21 removes clients not transmitting for 60 sec. */
+    static const uint8_t LOC_SUBSCRIPTIONS_MAX     = 16;    /* Z21 loc subscriptions per client, oldest removed. */
+
+    static request m_Requests[requestTypes];
+    static uint8_t m_LocSubscriptions; /* Locs subscribed by loc info requests after the active loc. */
+    static const uint16_t m_RequestTimeout[requestTypes];
+
+    static void RequestTransmit(requestType Type, uint16_t Address);
+    static bool RequestRetry(requestType Type);
+    static void RequestRefresh(requestType Type, uint16_t Address);
+    static void RequestResponse(requestType Type, uint16_t Address);
+    static void RequestSend(requestType Type);
+
     static pushButtonsEvent m_wmcPushButtonEvent;
 
-    static const uint32_t LOC_DATABASE_TX_DELAY = 200;
+    static const uint32_t LOC_DATABASE_TX_DELAY   = 200;
+    static const uint32_t LOC_SPEED_TX_INTERVAL   = 30;  /* Minimum time in msec between drive commands. */
+    static const uint32_t LOC_SPEED_REPLY_TIMEOUT = 500; /* Time in msec to wait for loc info after drive command. */
+
+#if APP_CFG_EVENT_TIMING == 1
+    /**
+     * Event handling time of a state.
+     */
+    struct eventTiming
+    {
+        uint32_t Count; /* Number of handled events. */
+        uint32_t Total; /* Sum of handling time in usec. */
+        uint32_t Max;   /* Longest handling time in usec. */
+    };
+
+    static const uint8_t EVENT_TIMING_STATES = 24;
+    static eventTiming m_EventTiming[EVENT_TIMING_STATES];
+    static uint32_t m_EventTimingReportTime;
+    static uint32_t m_EventTimingNested; /* Running sum of the handling time of (nested) events in usec. */
+    static uint32_t m_RxFrames;
+    static uint32_t m_RxFrameCycles;
+
+    static void EventTimingReport(void);
+#endif
+
+#if APP_CFG_LATENCY_MEASUREMENT == 1
+    static const uint8_t LATENCY_SAMPLES = 100;
+
+    /**
+     * Collected latency samples of one measurement.
+     */
+    struct latencyMeasurement
+    {
+        const char* Name;                  /* Name used in the report. */
+        uint32_t Samples[LATENCY_SAMPLES]; /* Latency in usec. */
+        uint8_t Count;                     /* Number of valid samples. */
+    };
+
+    static uint32_t m_LatencyStart;
+    static bool m_LatencyWirePending;
+    static bool m_LatencyWireDriveQueued; /* Drive command of the measured speed change is in the transmit buffer. */
+    static bool m_LatencyScreenPending;
+    static latencyMeasurement m_LatencyWire;
+    static latencyMeasurement m_LatencyScreen;
+
+    static void LatencyAdd(latencyMeasurement* MeasurementPtr, uint32_t Latency);
+#endif
 };
 
 #endif
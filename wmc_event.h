@@ -10,6 +10,7 @@
 /***********************************************************************************************************************
  * I N C L U D E S
  **********************************************************************************************************************/
+#include "Z21Slave.h"
 #include <tinyfsm.hpp>
 
 /***********************************************************************************************************************
@@ -126,6 +127,45 @@ struct cvProgEvent : tinyfsm::Event
     uint8_t CvValue;
 };
 
+/**
+ * Power status received from the Z21 control unit.
+ */
+struct z21TrackPowerEvent : tinyfsm::Event
+{
+    Z21Slave::dataType Status; /* trackPowerOff, trackPowerOn, programmingMode or emergencyStop. */
+};
+
+/**
+ * Loc info received from the Z21 control unit.
+ */
+struct z21LocInfoEvent : tinyfsm::Event
+{
+    Z21Slave::locInfo* InfoPtr; /* Decoded loc info. */
+};
+
+/**
+ * Loc library data received from the Z21 control unit.
+ */
+struct z21LocLibDataEvent : tinyfsm::Event
+{
+    Z21Slave::locLibData* DataPtr; /* Decoded loc library data. */
+};
+
+/**
+ * CV programming failed.
+ */
+struct z21CvNackEvent : tinyfsm::Event
+{
+};
+
+/**
+ * CV programming result received from the Z21 control unit.
+ */
+struct z21CvResultEvent : tinyfsm::Event
+{
+    Z21Slave::cvData* DataPtr; /* CV number and value. */
+};
+
 /***********************************************************************************************************************
  * C L A S S E S
  **********************************************************************************************************************/